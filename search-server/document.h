@@ -1,6 +1,10 @@
 #pragma once
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <vector>
 
 using namespace std::string_literals;
 
@@ -19,4 +23,46 @@ enum class DocumentStatus {
     REMOVED,
 };
 
+// Predicates SearchServer recognizes at compile time: they read document columns only, so
+// documents are checked before they are scored and sources without a matching document
+// are skipped.
+struct StatusPredicate {
+    DocumentStatus status;
+    bool operator()(int, DocumentStatus document_status, int) const {
+        return document_status == status;
+    }
+};
+
+struct AcceptAllPredicate {
+    bool operator()(int, DocumentStatus, int) const {
+        return true;
+    }
+};
+
+// Accepts documents of status whose value in the attribute column, an index returned by
+// SearchServer::AddAttributeColumn, lies in [min_value, max_value]. Recognized like the
+// predicates above; sources whose values all fall outside the range are skipped.
+struct AttributeRangePredicate {
+    std::size_t column;
+    std::int64_t min_value;
+    std::int64_t max_value;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+};
+
+// Input of SearchServer::AddDocuments. The server interns the words of the text and keeps no
+// reference to it, so the text may go away once AddDocuments returns.
+struct NewDocument {
+    int id = 0;
+    std::string_view text;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    std::vector<int> ratings;
+};
+
+// Results of a batch of queries in one buffer, compressed sparse row style: the results of
+// query i are documents[offsets[i]] up to documents[offsets[i + 1]], best first.
+struct BatchResults {
+    std::vector<Document> documents;
+    std::vector<std::size_t> offsets;
+};
+
 std::ostream& operator<<(std::ostream& out, const Document& document);
\ No newline at end of file
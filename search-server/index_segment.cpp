@@ -0,0 +1,461 @@
+#include "index_segment.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std::string_literals;
+
+namespace {
+
+constexpr char segment_magic[8] = {'S', 'R', 'C', 'H', 'S', 'E', 'G', '1'};
+constexpr std::uint64_t segment_version = 1;
+constexpr std::size_t section_alignment = 8;
+
+std::size_t AlignUp(std::size_t offset) {
+    return (offset + section_alignment - 1) / section_alignment * section_alignment;
+}
+
+static_assert(sizeof(DocumentStatus) == sizeof(int), "Document statuses are stored as int");
+
+void Check(bool condition, const char* what) {
+    if (!condition) {
+        throw std::invalid_argument("Index segment is corrupt: "s + what);
+    }
+}
+
+} // namespace
+
+// The image is the header followed by sections in this order, each starting at an
+// eight-byte boundary.
+struct IndexSegment::Header {
+    char magic[8];
+    std::uint64_t version;
+    std::uint64_t document_count;
+    std::uint64_t term_count;
+    std::uint64_t word_bytes;
+    std::uint64_t block_count;
+    std::uint64_t posting_data_size;
+    std::uint64_t forward_entry_count;
+    std::uint64_t stop_word_count;
+    std::uint64_t stop_word_bytes;
+};
+
+struct IndexSegment::TermEntry {
+    std::uint64_t first_block;
+    std::uint64_t block_count;
+    std::uint64_t data_offset;
+    std::uint64_t posting_count;
+    double max_term_freq;
+};
+
+std::shared_ptr<const IndexSegment> IndexSegment::Open(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open index segment "s + path);
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+        close(fd);
+        throw std::runtime_error("Cannot read index segment "s + path);
+    }
+    const std::size_t size = static_cast<std::size_t>(file_stat.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Cannot map index segment "s + path);
+    }
+
+    std::shared_ptr<IndexSegment> segment(new IndexSegment());
+    segment->mapping_ = mapping;
+    segment->mapping_size_ = size;
+    segment->Parse(static_cast<const std::uint8_t*>(mapping), size, false);
+    return segment;
+}
+
+std::shared_ptr<const IndexSegment> IndexSegment::FromImage(std::vector<std::uint8_t> image) {
+    std::shared_ptr<IndexSegment> segment(new IndexSegment());
+    segment->owned_image_ = std::move(image);
+    segment->Parse(segment->owned_image_.data(), segment->owned_image_.size(), false);
+    return segment;
+}
+
+IndexSegment::~IndexSegment() {
+    if (mapping_ != nullptr) {
+        munmap(mapping_, mapping_size_);
+    }
+}
+
+std::size_t IndexSegment::GetDocumentCount() const {
+    return header_->document_count;
+}
+
+std::size_t IndexSegment::GetTermCount() const {
+    return header_->term_count;
+}
+
+std::optional<TermId> IndexSegment::FindTerm(std::string_view word) const {
+    TermId first = 0;
+    TermId last = static_cast<TermId>(header_->term_count);
+    while (first < last) {
+        const TermId middle = first + (last - first) / 2;
+        if (GetWord(middle) < word) {
+            first = middle + 1;
+        } else {
+            last = middle;
+        }
+    }
+    if (first < header_->term_count && GetWord(first) == word) {
+        return first;
+    }
+    return std::nullopt;
+}
+
+std::string_view IndexSegment::GetWord(TermId term_id) const {
+    return {words_ + word_offsets_[term_id], word_offsets_[term_id + 1] - word_offsets_[term_id]};
+}
+
+PostingListView IndexSegment::GetPostings(TermId term_id) const {
+    if (checked_terms_ && !checked_terms_[term_id].load(std::memory_order_acquire)) {
+        ValidateTerm(term_id);
+        checked_terms_[term_id].store(true, std::memory_order_release);
+    }
+    return MakePostingsView(term_id);
+}
+
+PostingListView IndexSegment::MakePostingsView(TermId term_id) const {
+    const TermEntry& term = terms_[term_id];
+    return {blocks_ + term.first_block, term.block_count, posting_data_ + term.data_offset,
+            nullptr, 0, term.posting_count};
+}
+
+double IndexSegment::GetMaxTermFreq(TermId term_id) const {
+    return terms_[term_id].max_term_freq;
+}
+
+const int* IndexSegment::GetDocumentIds() const {
+    return document_ids_;
+}
+
+const int* IndexSegment::GetRatings() const {
+    return ratings_;
+}
+
+const DocumentStatus* IndexSegment::GetStatuses() const {
+    return statuses_;
+}
+
+const double* IndexSegment::GetInvWordCounts() const {
+    return inv_word_counts_;
+}
+
+std::optional<std::uint32_t> IndexSegment::FindOrdinal(int document_id) const {
+    const int* last = sorted_document_ids_ + header_->document_count;
+    const int* it = std::lower_bound(sorted_document_ids_, last, document_id);
+    if (it == last || *it != document_id) {
+        return std::nullopt;
+    }
+    return sorted_ordinals_[it - sorted_document_ids_];
+}
+
+std::pair<const IndexSegment::ForwardEntry*, const IndexSegment::ForwardEntry*>
+IndexSegment::GetForwardEntries(std::uint32_t ordinal) const {
+    if (checked_documents_ && !checked_documents_[ordinal].load(std::memory_order_acquire)) {
+        ValidateForwardEntries(ordinal);
+        checked_documents_[ordinal].store(true, std::memory_order_release);
+    }
+    return {forward_entries_ + forward_offsets_[ordinal], forward_entries_ + forward_offsets_[ordinal + 1]};
+}
+
+std::vector<std::string_view> IndexSegment::GetStopWords() const {
+    std::vector<std::string_view> stop_words;
+    stop_words.reserve(header_->stop_word_count);
+    for (std::size_t i = 0; i < header_->stop_word_count; ++i) {
+        stop_words.emplace_back(stop_words_ + stop_word_offsets_[i],
+                                stop_word_offsets_[i + 1] - stop_word_offsets_[i]);
+    }
+    return stop_words;
+}
+
+// Sizes come from the image, so every product is checked against the image size before it is
+// computed.
+void IndexSegment::Parse(const std::uint8_t* image, std::size_t size, bool is_trusted) {
+    std::size_t offset = 0;
+    const auto take = [image, size, &offset](std::uint64_t count, std::size_t element_size) {
+        offset = AlignUp(offset);
+        if (offset > size || count > (size - offset) / element_size) {
+            throw std::invalid_argument("Index segment is truncated"s);
+        }
+        const std::uint8_t* section = image + offset;
+        offset += static_cast<std::size_t>(count) * element_size;
+        return section;
+    };
+    // An offset table has an entry past the last element.
+    const auto take_offsets = [&take, size](std::uint64_t count) {
+        if (count >= size) {
+            throw std::invalid_argument("Index segment is truncated"s);
+        }
+        return reinterpret_cast<const std::uint64_t*>(take(count + 1, sizeof(std::uint64_t)));
+    };
+
+    header_ = reinterpret_cast<const Header*>(take(1, sizeof(Header)));
+    if (std::memcmp(header_->magic, segment_magic, sizeof(segment_magic)) != 0) {
+        throw std::invalid_argument("Not an index segment"s);
+    }
+    if (header_->version != segment_version) {
+        throw std::invalid_argument("Unsupported index segment version "s + std::to_string(header_->version));
+    }
+    const std::uint64_t document_count = header_->document_count;
+    if (document_count > SegmentBuilder::no_ordinal) {
+        throw std::invalid_argument("Index segment has too many documents"s);
+    }
+
+    terms_ = reinterpret_cast<const TermEntry*>(take(header_->term_count, sizeof(TermEntry)));
+    word_offsets_ = take_offsets(header_->term_count);
+    words_ = reinterpret_cast<const char*>(take(header_->word_bytes, 1));
+    blocks_ = reinterpret_cast<const PostingBlock*>(take(header_->block_count, sizeof(PostingBlock)));
+    posting_data_ = take(header_->posting_data_size, 1);
+    document_ids_ = reinterpret_cast<const int*>(take(document_count, sizeof(int)));
+    ratings_ = reinterpret_cast<const int*>(take(document_count, sizeof(int)));
+    statuses_ = reinterpret_cast<const DocumentStatus*>(take(document_count, sizeof(DocumentStatus)));
+    inv_word_counts_ = reinterpret_cast<const double*>(take(document_count, sizeof(double)));
+    sorted_document_ids_ = reinterpret_cast<const int*>(take(document_count, sizeof(int)));
+    sorted_ordinals_ = reinterpret_cast<const std::uint32_t*>(take(document_count, sizeof(std::uint32_t)));
+    forward_offsets_ = take_offsets(document_count);
+    forward_entries_ = reinterpret_cast<const ForwardEntry*>(
+        take(header_->forward_entry_count, sizeof(ForwardEntry)));
+    stop_word_offsets_ = take_offsets(header_->stop_word_count);
+    stop_words_ = reinterpret_cast<const char*>(take(header_->stop_word_bytes, 1));
+
+    if (!is_trusted) {
+        ValidateLayout();
+        checked_terms_ = std::make_unique<std::atomic<bool>[]>(header_->term_count);
+        checked_documents_ = std::make_unique<std::atomic<bool>[]>(document_count);
+    }
+}
+
+// Work proportional to the terms and documents, reading none of the postings and forward
+// entries, which ValidateTerm and ValidateForwardEntries check once they are used.
+void IndexSegment::ValidateLayout() const {
+    const auto check_offsets = [](const std::uint64_t* offsets, std::uint64_t count, std::uint64_t end,
+                                  const char* what) {
+        Check(offsets[0] == 0 && offsets[count] == end, what);
+        for (std::uint64_t i = 0; i < count; ++i) {
+            Check(offsets[i] <= offsets[i + 1], what);
+        }
+    };
+    const std::uint64_t document_count = header_->document_count;
+    const std::uint64_t term_count = header_->term_count;
+    Check(term_count <= std::numeric_limits<TermId>::max(), "term count");
+
+    check_offsets(word_offsets_, term_count, header_->word_bytes, "word offsets");
+    check_offsets(stop_word_offsets_, header_->stop_word_count, header_->stop_word_bytes, "stop word offsets");
+    check_offsets(forward_offsets_, document_count, header_->forward_entry_count, "forward offsets");
+    for (std::uint64_t term_id = 0; term_id < term_count; ++term_id) {
+        const TermEntry& term = terms_[term_id];
+        Check(term.first_block <= header_->block_count && term.block_count <= header_->block_count - term.first_block,
+              "term blocks");
+        Check(term.data_offset <= header_->posting_data_size, "term data offset");
+    }
+
+    for (std::uint64_t ordinal = 0; ordinal < document_count; ++ordinal) {
+        Check(static_cast<std::size_t>(statuses_[ordinal]) <= static_cast<std::size_t>(DocumentStatus::REMOVED),
+              "document status");
+        Check(sorted_ordinals_[ordinal] < document_count, "sorted ordinal");
+        Check(document_ids_[sorted_ordinals_[ordinal]] == sorted_document_ids_[ordinal], "sorted document id");
+        Check(ordinal == 0 || sorted_document_ids_[ordinal - 1] < sorted_document_ids_[ordinal], "sorted document ids");
+    }
+}
+
+// Blocks must lie within the posting data and decode to ascending ordinals of documents in
+// the segment.
+void IndexSegment::ValidateTerm(TermId term_id) const {
+    const TermEntry& term = terms_[term_id];
+    const std::uint64_t data_size = header_->posting_data_size - term.data_offset;
+    std::uint64_t posting_count = 0;
+    for (std::uint64_t i = 0; i < term.block_count; ++i) {
+        const PostingBlock& block = blocks_[term.first_block + i];
+        Check(block.length > 0 && block.length <= PostingListView::block_size, "block length");
+        Check(block.offset <= data_size && PostingListView::GetControlSize(block.length) <= data_size - block.offset,
+              "block offset");
+        const std::uint8_t* data = posting_data_ + term.data_offset + block.offset;
+        Check(PostingListView::GetEncodedBlockSize(data, block.length) <= data_size - block.offset, "block size");
+        posting_count += block.length;
+    }
+    Check(posting_count == term.posting_count, "term posting count");
+    std::uint64_t next_ordinal = 0;
+    for (PostingListCursor cursor(MakePostingsView(term_id)); !cursor.IsEnd(); cursor.Next()) {
+        Check(cursor->ordinal >= next_ordinal && cursor->ordinal < header_->document_count, "posting ordinal");
+        next_ordinal = std::uint64_t{cursor->ordinal} + 1;
+    }
+}
+
+void IndexSegment::ValidateForwardEntries(std::uint32_t ordinal) const {
+    for (std::uint64_t i = forward_offsets_[ordinal]; i < forward_offsets_[ordinal + 1]; ++i) {
+        Check(forward_entries_[i].term_id < header_->term_count, "forward entry term");
+    }
+}
+
+std::uint32_t SegmentBuilder::AddDocument(int document_id, int rating, DocumentStatus status,
+                                          double inv_word_count) {
+    document_ids_.push_back(document_id);
+    ratings_.push_back(rating);
+    statuses_.push_back(status);
+    inv_word_counts_.push_back(inv_word_count);
+    document_term_counts_.push_back(0);
+    return static_cast<std::uint32_t>(document_ids_.size() - 1);
+}
+
+void SegmentBuilder::AddPosting(std::string_view word, Posting posting) {
+    TermPostings& term = GetTermPostings(word);
+    term.postings.Append(posting);
+    ++document_term_counts_[posting.ordinal];
+    term.max_term_freq = std::max(term.max_term_freq, posting.term_count * inv_word_counts_[posting.ordinal]);
+}
+
+void SegmentBuilder::AddPostings(std::string_view word, const PostingListView& postings,
+                                 const std::vector<std::uint32_t>& new_ordinals) {
+    TermPostings* term = nullptr;
+    postings.ForEach([&](const Posting& posting) {
+        const std::uint32_t ordinal = new_ordinals[posting.ordinal];
+        if (ordinal == no_ordinal) {
+            return;
+        }
+        if (term == nullptr) {
+            term = &GetTermPostings(word);
+        }
+        term->postings.Append({ordinal, posting.term_count});
+        ++document_term_counts_[ordinal];
+        term->max_term_freq = std::max(term->max_term_freq, posting.term_count * inv_word_counts_[ordinal]);
+    });
+}
+
+std::vector<std::uint8_t> SegmentBuilder::Build() {
+    const std::size_t document_count = document_ids_.size();
+    std::vector<std::uint8_t> image;
+    const auto append = [&image](const void* data, std::size_t bytes) {
+        image.resize(AlignUp(image.size()), 0);
+        const auto* first = static_cast<const std::uint8_t*>(data);
+        image.insert(image.end(), first, first + bytes);
+    };
+
+    std::vector<IndexSegment::TermEntry> term_entries;
+    std::vector<std::uint64_t> word_offsets = {0};
+    std::string words;
+    std::vector<PostingBlock> blocks;
+    std::vector<std::uint8_t> posting_data;
+    // Terms are visited in id order, so filling each document's range in place sorts it.
+    std::vector<std::uint64_t> forward_offsets(document_count + 1, 0);
+    for (std::size_t ordinal = 0; ordinal < document_count; ++ordinal) {
+        forward_offsets[ordinal + 1] = forward_offsets[ordinal] + document_term_counts_[ordinal];
+    }
+    std::vector<IndexSegment::ForwardEntry> forward_entries(forward_offsets.back());
+    std::vector<std::uint64_t> forward_ends(forward_offsets.begin(), forward_offsets.end() - 1);
+    term_entries.reserve(terms_.size());
+    for (auto& [word, term] : terms_) {
+        const TermId term_id = static_cast<TermId>(term_entries.size());
+        term.postings.Seal();
+        const std::vector<PostingBlock>& term_blocks = term.postings.GetBlocks();
+        const std::vector<std::uint8_t>& term_data = term.postings.GetData();
+        term_entries.push_back({blocks.size(), term_blocks.size(), posting_data.size(),
+                                term.postings.size(), term.max_term_freq});
+        blocks.insert(blocks.end(), term_blocks.begin(), term_blocks.end());
+        posting_data.insert(posting_data.end(), term_data.begin(), term_data.end());
+        words += word;
+        word_offsets.push_back(words.size());
+        term.postings.GetView().ForEach([&forward_entries, &forward_ends, term_id](const Posting& posting) {
+            forward_entries[forward_ends[posting.ordinal]++] = {term_id, posting.term_count};
+        });
+    }
+
+    std::vector<std::pair<int, std::uint32_t>> id_index(document_count);
+    for (std::size_t ordinal = 0; ordinal < document_count; ++ordinal) {
+        id_index[ordinal] = {document_ids_[ordinal], static_cast<std::uint32_t>(ordinal)};
+    }
+    std::sort(id_index.begin(), id_index.end());
+    std::vector<int> sorted_document_ids(document_count);
+    std::vector<std::uint32_t> sorted_ordinals(document_count);
+    for (std::size_t i = 0; i < document_count; ++i) {
+        sorted_document_ids[i] = id_index[i].first;
+        sorted_ordinals[i] = id_index[i].second;
+    }
+
+    std::vector<std::uint64_t> stop_word_offsets = {0};
+    std::string stop_words;
+    for (const std::string& stop_word : stop_words_) {
+        stop_words += stop_word;
+        stop_word_offsets.push_back(stop_words.size());
+    }
+
+    IndexSegment::Header header;
+    std::memcpy(header.magic, segment_magic, sizeof(segment_magic));
+    header.version = segment_version;
+    header.document_count = document_count;
+    header.term_count = term_entries.size();
+    header.word_bytes = words.size();
+    header.block_count = blocks.size();
+    header.posting_data_size = posting_data.size();
+    header.forward_entry_count = forward_entries.size();
+    header.stop_word_count = stop_words_.size();
+    header.stop_word_bytes = stop_words.size();
+
+    append(&header, sizeof(header));
+    append(term_entries.data(), term_entries.size() * sizeof(IndexSegment::TermEntry));
+    append(word_offsets.data(), word_offsets.size() * sizeof(std::uint64_t));
+    append(words.data(), words.size());
+    append(blocks.data(), blocks.size() * sizeof(PostingBlock));
+    append(posting_data.data(), posting_data.size());
+    append(document_ids_.data(), document_count * sizeof(int));
+    append(ratings_.data(), document_count * sizeof(int));
+    append(statuses_.data(), document_count * sizeof(DocumentStatus));
+    append(inv_word_counts_.data(), document_count * sizeof(double));
+    append(sorted_document_ids.data(), document_count * sizeof(int));
+    append(sorted_ordinals.data(), document_count * sizeof(std::uint32_t));
+    append(forward_offsets.data(), forward_offsets.size() * sizeof(std::uint64_t));
+    append(forward_entries.data(), forward_entries.size() * sizeof(IndexSegment::ForwardEntry));
+    append(stop_word_offsets.data(), stop_word_offsets.size() * sizeof(std::uint64_t));
+    append(stop_words.data(), stop_words.size());
+    return image;
+}
+
+std::shared_ptr<const IndexSegment> SegmentBuilder::BuildSegment() {
+    std::shared_ptr<IndexSegment> segment(new IndexSegment());
+    segment->owned_image_ = Build();
+    segment->Parse(segment->owned_image_.data(), segment->owned_image_.size(), true);
+    return segment;
+}
+
+SegmentBuilder::TermPostings& SegmentBuilder::GetTermPostings(std::string_view word) {
+    auto it = terms_.find(word);
+    if (it == terms_.end()) {
+        it = terms_.emplace(std::string(word), TermPostings{}).first;
+    }
+    return it->second;
+}
+
+// Writes to a temporary file renamed over path, so segments already mapped from path keep
+// their contents.
+void SegmentBuilder::Write(const std::string& path) {
+    const std::vector<std::uint8_t> image = Build();
+    const std::string temporary_path = path + ".tmp"s;
+    {
+        std::ofstream out(temporary_path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(image.data()), static_cast<std::streamsize>(image.size()));
+        if (!out) {
+            throw std::runtime_error("Cannot write index segment "s + path);
+        }
+    }
+    if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+        std::remove(temporary_path.c_str());
+        throw std::runtime_error("Cannot write index segment "s + path);
+    }
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include "document.h"
+#include "posting_list.h"
+#include "term_dictionary.h"
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Immutable index over a fixed set of documents kept in one contiguous byte image, either
+// owned or memory-mapped from a file, and read in place. Terms are sorted, so term ids
+// follow word order. Documents are numbered by segment-local ordinals.
+class IndexSegment {
+public:
+    struct ForwardEntry {
+        TermId term_id;
+        std::uint32_t term_count;
+    };
+
+    // Both check the header, offset tables and document columns up front, and the postings
+    // of a term or the forward entries of a document on first access, so opening a mapped
+    // file reads little of it. Damaged parts throw std::invalid_argument when reached.
+    static std::shared_ptr<const IndexSegment> Open(const std::string& path);
+    static std::shared_ptr<const IndexSegment> FromImage(std::vector<std::uint8_t> image);
+
+    IndexSegment(const IndexSegment&) = delete;
+    IndexSegment& operator=(const IndexSegment&) = delete;
+    ~IndexSegment();
+
+    std::size_t GetDocumentCount() const;
+    std::size_t GetTermCount() const;
+
+    std::optional<TermId> FindTerm(std::string_view word) const;
+    std::string_view GetWord(TermId term_id) const;
+    PostingListView GetPostings(TermId term_id) const;
+    double GetMaxTermFreq(TermId term_id) const;
+
+    // Columns indexed by ordinal.
+    const int* GetDocumentIds() const;
+    const int* GetRatings() const;
+    const DocumentStatus* GetStatuses() const;
+    const double* GetInvWordCounts() const;
+
+    std::optional<std::uint32_t> FindOrdinal(int document_id) const;
+
+    // Terms of a document sorted by term id.
+    std::pair<const ForwardEntry*, const ForwardEntry*> GetForwardEntries(std::uint32_t ordinal) const;
+
+    std::vector<std::string_view> GetStopWords() const;
+
+private:
+    struct Header;
+    struct TermEntry;
+
+    std::vector<std::uint8_t> owned_image_;
+    void* mapping_ = nullptr;
+    std::size_t mapping_size_ = 0;
+
+    const Header* header_ = nullptr;
+    const TermEntry* terms_ = nullptr;
+    const std::uint64_t* word_offsets_ = nullptr;
+    const char* words_ = nullptr;
+    const PostingBlock* blocks_ = nullptr;
+    const std::uint8_t* posting_data_ = nullptr;
+    const int* document_ids_ = nullptr;
+    const int* ratings_ = nullptr;
+    const DocumentStatus* statuses_ = nullptr;
+    const double* inv_word_counts_ = nullptr;
+    const int* sorted_document_ids_ = nullptr;
+    const std::uint32_t* sorted_ordinals_ = nullptr;
+    const std::uint64_t* forward_offsets_ = nullptr;
+    const ForwardEntry* forward_entries_ = nullptr;
+    const std::uint64_t* stop_word_offsets_ = nullptr;
+    const char* stop_words_ = nullptr;
+    // Terms and documents that passed their checks, or nullptr for images built in this
+    // process, which are not checked.
+    std::unique_ptr<std::atomic<bool>[]> checked_terms_;
+    std::unique_ptr<std::atomic<bool>[]> checked_documents_;
+
+    IndexSegment() = default;
+
+    void Parse(const std::uint8_t* image, std::size_t size, bool is_trusted);
+    // Checks everything but the postings and forward entries.
+    void ValidateLayout() const;
+    void ValidateTerm(TermId term_id) const;
+    void ValidateForwardEntries(std::uint32_t ordinal) const;
+
+    PostingListView MakePostingsView(TermId term_id) const;
+
+    friend class SegmentBuilder;
+};
+
+// Collects documents and postings and lays them out as an IndexSegment image.
+class SegmentBuilder {
+public:
+    template <typename StringContainer>
+    void SetStopWords(const StringContainer& stop_words);
+
+    // Returns the ordinal of the added document.
+    std::uint32_t AddDocument(int document_id, int rating, DocumentStatus status, double inv_word_count);
+
+    // Postings of a word must be added in ascending ordinal order.
+    void AddPosting(std::string_view word, Posting posting);
+    // Adds postings of word from another index, whose ordinals map to ordinals of this
+    // builder through new_ordinals; postings mapped to no_ordinal are skipped.
+    void AddPostings(std::string_view word, const PostingListView& postings,
+                     const std::vector<std::uint32_t>& new_ordinals);
+
+    static constexpr std::uint32_t no_ordinal = UINT32_MAX;
+
+    std::vector<std::uint8_t> Build();
+    // Same, parsed in place without the checks images from elsewhere get.
+    std::shared_ptr<const IndexSegment> BuildSegment();
+
+    void Write(const std::string& path);
+
+private:
+    struct TermPostings {
+        PostingList postings;
+        double max_term_freq = 0.0;
+    };
+
+    std::vector<std::string> stop_words_;
+    std::map<std::string, TermPostings, std::less<>> terms_;
+    std::vector<int> document_ids_;
+    std::vector<int> ratings_;
+    std::vector<DocumentStatus> statuses_;
+    std::vector<double> inv_word_counts_;
+    std::vector<std::uint32_t> document_term_counts_;
+
+    TermPostings& GetTermPostings(std::string_view word);
+};
+
+template <typename StringContainer>
+void SegmentBuilder::SetStopWords(const StringContainer& stop_words) {
+    stop_words_.assign(stop_words.begin(), stop_words.end());
+}
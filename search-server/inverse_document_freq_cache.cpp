@@ -0,0 +1,39 @@
+#include "inverse_document_freq_cache.h"
+
+InverseDocumentFreqCache::InverseDocumentFreqCache(std::size_t term_count) {
+    Resize(term_count);
+}
+
+InverseDocumentFreqCache::InverseDocumentFreqCache(const InverseDocumentFreqCache&) {
+}
+
+InverseDocumentFreqCache& InverseDocumentFreqCache::operator=(const InverseDocumentFreqCache&) {
+    entries_.clear();
+    return *this;
+}
+
+void InverseDocumentFreqCache::Resize(std::size_t term_count) {
+    while (entries_.size() < term_count) {
+        entries_.emplace_back();
+    }
+}
+
+std::optional<double> InverseDocumentFreqCache::Find(TermId term_id, std::uint64_t generation) const {
+    if (term_id >= entries_.size()) {
+        return std::nullopt;
+    }
+    const Entry& entry = entries_[term_id];
+    if (entry.generation.load(std::memory_order_acquire) != generation) {
+        return std::nullopt;
+    }
+    return entry.inverse_document_freq.load(std::memory_order_relaxed);
+}
+
+void InverseDocumentFreqCache::Store(TermId term_id, std::uint64_t generation, double inverse_document_freq) const {
+    if (term_id >= entries_.size()) {
+        return;
+    }
+    Entry& entry = entries_[term_id];
+    entry.inverse_document_freq.store(inverse_document_freq, std::memory_order_relaxed);
+    entry.generation.store(generation, std::memory_order_release);
+}
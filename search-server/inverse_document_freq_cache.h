@@ -0,0 +1,37 @@
+#pragma once
+#include "term_dictionary.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <optional>
+
+// Inverse document frequencies of the terms of one index source, each valid only for the
+// index generation it was computed in. Concurrent queries may fill the same entry: within
+// a generation they all compute the same value, and the generation only changes while the
+// index is being modified, which excludes queries. Copies start empty.
+class InverseDocumentFreqCache {
+public:
+    InverseDocumentFreqCache() = default;
+    explicit InverseDocumentFreqCache(std::size_t term_count);
+    InverseDocumentFreqCache(const InverseDocumentFreqCache&);
+    InverseDocumentFreqCache& operator=(const InverseDocumentFreqCache&);
+    InverseDocumentFreqCache(InverseDocumentFreqCache&&) = default;
+    InverseDocumentFreqCache& operator=(InverseDocumentFreqCache&&) = default;
+
+    // Grows to term_count entries; existing entries are kept.
+    void Resize(std::size_t term_count);
+
+    // Terms past the cache size are never cached.
+    std::optional<double> Find(TermId term_id, std::uint64_t generation) const;
+    void Store(TermId term_id, std::uint64_t generation, double inverse_document_freq) const;
+
+private:
+    struct Entry {
+        // 0 marks an empty entry.
+        std::atomic<std::uint64_t> generation{0};
+        std::atomic<double> inverse_document_freq{0.0};
+    };
+    // Entries are atomic and cannot move, which a deque never needs when growing.
+    mutable std::deque<Entry> entries_;
+};
@@ -0,0 +1,280 @@
+#include "posting_list.h"
+#include "simd.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+std::size_t GetByteLength(std::uint32_t value) {
+    if (value < (1u << 8)) {
+        return 1;
+    }
+    if (value < (1u << 16)) {
+        return 2;
+    }
+    if (value < (1u << 24)) {
+        return 3;
+    }
+    return 4;
+}
+
+bool IsPostingBefore(const Posting& posting, std::uint32_t ordinal) {
+    return posting.ordinal < ordinal;
+}
+
+#if (defined(__x86_64__) || defined(_M_X64)) && defined(__GNUC__)
+#define SEARCH_SERVER_SSSE3
+
+// For every control byte, the shuffle that spreads its four values over 32-bit lanes and
+// the bytes they take.
+struct ShuffleTables {
+    std::uint8_t shuffles[256][16];
+    std::uint8_t lengths[256];
+};
+
+constexpr ShuffleTables MakeShuffleTables() {
+    ShuffleTables tables{};
+    for (std::size_t control = 0; control < 256; ++control) {
+        std::uint8_t offset = 0;
+        for (std::size_t value = 0; value < 4; ++value) {
+            const std::size_t length = ((control >> (2 * value)) & 3) + 1;
+            for (std::size_t byte = 0; byte < 4; ++byte) {
+                // A set high bit makes the shuffle write a zero.
+                const std::size_t source_byte = byte < length ? offset + byte : 0x80;
+                tables.shuffles[control][value * 4 + byte] = static_cast<std::uint8_t>(source_byte);
+            }
+            offset += static_cast<std::uint8_t>(length);
+        }
+        tables.lengths[control] = offset;
+    }
+    return tables;
+}
+
+constexpr ShuffleTables shuffle_tables = MakeShuffleTables();
+
+// Decodes group_count groups of four values, one shuffle each. Every group loads 16 bytes,
+// so callers leave at least three groups after them to stay within the encoded values.
+__attribute__((target("ssse3"))) const std::uint8_t* DecodeGroupsSsse3(const std::uint8_t* control,
+                                                                     const std::uint8_t* bytes,
+                                                                     std::size_t group_count,
+                                                                     std::uint32_t* values) {
+    for (std::size_t group = 0; group < group_count; ++group) {
+        const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes));
+        const std::uint8_t* shuffle_bytes = shuffle_tables.shuffles[control[group]];
+        const __m128i shuffle = _mm_loadu_si128(reinterpret_cast<const __m128i*>(shuffle_bytes));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(values + group * 4), _mm_shuffle_epi8(data, shuffle));
+        bytes += shuffle_tables.lengths[control[group]];
+    }
+    return bytes;
+}
+#endif
+
+} // namespace
+
+PostingListCursor::PostingListCursor(const PostingListView& postings)
+    : postings_(postings) {
+    LoadBlock(0);
+}
+
+bool PostingListCursor::IsEnd() const {
+    return position_ == block_length_;
+}
+
+const Posting& PostingListCursor::operator*() const {
+    return block_[position_];
+}
+
+const Posting* PostingListCursor::operator->() const {
+    return &block_[position_];
+}
+
+void PostingListCursor::Next() {
+    if (++position_ == block_length_) {
+        LoadBlock(block_index_ + 1);
+    }
+}
+
+void PostingListCursor::SkipTo(std::uint32_t ordinal) {
+    if (IsEnd() || block_[position_].ordinal >= ordinal) {
+        return;
+    }
+    if (block_[block_length_ - 1].ordinal < ordinal) {
+        LoadBlock(std::max(block_index_ + 1, postings_.FindBlock(ordinal)));
+        if (IsEnd()) {
+            return;
+        }
+    }
+    position_ = std::lower_bound(block_.begin() + position_, block_.begin() + block_length_, ordinal,
+                                 IsPostingBefore) - block_.begin();
+}
+
+void PostingListCursor::LoadBlock(std::size_t block_index) {
+    block_index_ = block_index;
+    position_ = 0;
+    block_length_ = 0;
+    while (block_index_ < postings_.GetBlockCount() && block_length_ == 0) {
+        block_length_ = postings_.DecodeBlock(block_index_, block_.data());
+        if (block_length_ == 0) {
+            ++block_index_;
+        }
+    }
+}
+
+PostingListView::PostingListView(const PostingBlock* blocks, std::size_t block_count, const std::uint8_t* data,
+                                 const Posting* tail, std::size_t tail_size, std::size_t size)
+    : blocks_(blocks)
+    , block_count_(block_count)
+    , data_(data)
+    , tail_(tail)
+    , tail_size_(tail_size)
+    , size_(size) {
+}
+
+std::size_t PostingListView::size() const {
+    return size_;
+}
+
+bool PostingListView::empty() const {
+    return size_ == 0;
+}
+
+std::size_t PostingListView::GetBlockCount() const {
+    return block_count_ + 1;
+}
+
+// Returns the first block that may hold ordinal, the tail if no compressed block does,
+// or GetBlockCount() if ordinal is past every posting.
+std::size_t PostingListView::FindBlock(std::uint32_t ordinal) const {
+    const PostingBlock* it = std::lower_bound(blocks_, blocks_ + block_count_, ordinal,
+                                              [](const PostingBlock& block, std::uint32_t value) {
+                                                  return block.last_ordinal < value;
+                                              });
+    if (it != blocks_ + block_count_) {
+        return it - blocks_;
+    }
+    if (tail_size_ > 0 && tail_[tail_size_ - 1].ordinal >= ordinal) {
+        return block_count_;
+    }
+    return GetBlockCount();
+}
+
+std::size_t PostingListView::DecodeBlock(std::size_t block_index, Posting* postings) const {
+    if (block_index == block_count_) {
+        std::copy(tail_, tail_ + tail_size_, postings);
+        return tail_size_;
+    }
+    const PostingBlock& block = blocks_[block_index];
+    DecodeBlock(data_ + block.offset, block.first_ordinal, block.length, postings);
+    return block.length;
+}
+
+// Values are the ordinal deltas followed by term_count - 1 for every posting.
+void PostingListView::EncodeBlock(const Posting* postings, std::size_t count, std::vector<std::uint8_t>& out) {
+    const std::size_t value_count = count * 2;
+    const auto value_at = [postings, count](std::size_t i) -> std::uint32_t {
+        if (i < count) {
+            return i == 0 ? 0 : postings[i].ordinal - postings[i - 1].ordinal;
+        }
+        return postings[i - count].term_count - 1;
+    };
+    const std::size_t control_begin = out.size();
+    out.resize(control_begin + GetControlSize(count), 0);
+    for (std::size_t i = 0; i < value_count; ++i) {
+        std::uint32_t value = value_at(i);
+        const std::size_t length = GetByteLength(value);
+        out[control_begin + i / 4] |= static_cast<std::uint8_t>((length - 1) << (2 * (i % 4)));
+        for (std::size_t byte = 0; byte < length; ++byte) {
+            out.push_back(static_cast<std::uint8_t>(value));
+            value >>= 8;
+        }
+    }
+}
+
+std::size_t PostingListView::GetControlSize(std::size_t count) {
+    return (count * 2 + 3) / 4;
+}
+
+std::size_t PostingListView::GetEncodedBlockSize(const std::uint8_t* data, std::size_t count) {
+    std::size_t size = GetControlSize(count);
+    for (std::size_t i = 0; i < count * 2; ++i) {
+        size += ((data[i / 4] >> (2 * (i % 4))) & 3) + 1;
+    }
+    return size;
+}
+
+// Every value takes at least one byte, so the last three groups of four values hold at
+// least the 12 bytes the shuffle decoder may read past the group before them.
+void PostingListView::DecodeBlock(const std::uint8_t* data, std::uint32_t first_ordinal, std::size_t count,
+                                  Posting* postings) {
+    const std::uint8_t* control = data;
+    const std::uint8_t* bytes = data + GetControlSize(count);
+    const std::size_t value_count = count * 2;
+    std::array<std::uint32_t, block_size * 2> values;
+    std::size_t i = 0;
+#ifdef SEARCH_SERVER_SSSE3
+    if (value_count >= 16 && GetSimdLevel() >= SimdLevel::SSSE3) {
+        const std::size_t group_count = value_count / 4 - 3;
+        bytes = DecodeGroupsSsse3(control, bytes, group_count, values.data());
+        i = group_count * 4;
+    }
+#endif
+    for (; i < value_count; ++i) {
+        const std::size_t length = ((control[i / 4] >> (2 * (i % 4))) & 3) + 1;
+        std::uint32_t value = bytes[0];
+        for (std::size_t byte = 1; byte < length; ++byte) {
+            value |= static_cast<std::uint32_t>(bytes[byte]) << (8 * byte);
+        }
+        bytes += length;
+        values[i] = value;
+    }
+    std::uint32_t ordinal = first_ordinal;
+    for (std::size_t j = 0; j < count; ++j) {
+        ordinal += values[j];
+        postings[j] = {ordinal, values[count + j] + 1};
+    }
+}
+
+void PostingList::Append(Posting posting) {
+    tail_.push_back(posting);
+    ++size_;
+    if (tail_.size() == block_size) {
+        FlushTail();
+    }
+}
+
+void PostingList::Seal() {
+    if (!tail_.empty()) {
+        FlushTail();
+    }
+}
+
+PostingListView PostingList::GetView() const {
+    return {blocks_.data(), blocks_.size(), data_.data(), tail_.data(), tail_.size(), size_};
+}
+
+const std::vector<PostingBlock>& PostingList::GetBlocks() const {
+    return blocks_;
+}
+
+const std::vector<std::uint8_t>& PostingList::GetData() const {
+    return data_;
+}
+
+std::size_t PostingList::size() const {
+    return size_;
+}
+
+bool PostingList::empty() const {
+    return size_ == 0;
+}
+
+void PostingList::FlushTail() {
+    blocks_.push_back({tail_.front().ordinal, tail_.back().ordinal,
+                       static_cast<std::uint32_t>(data_.size()), static_cast<std::uint32_t>(tail_.size())});
+    PostingListView::EncodeBlock(tail_.data(), tail_.size(), data_);
+    tail_.clear();
+}
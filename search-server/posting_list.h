@@ -0,0 +1,136 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+
+struct Posting {
+    std::uint32_t ordinal;
+    std::uint32_t term_count;
+};
+
+// Skip table entry of a compressed block; offset is relative to the list's data.
+struct PostingBlock {
+    std::uint32_t first_ordinal;
+    std::uint32_t last_ordinal;
+    std::uint32_t offset;
+    std::uint32_t length;
+};
+
+// Read-only access to postings sorted by ordinal: compressed blocks followed by an optional
+// uncompressed tail. Within a block, ordinal deltas and term counts are stored
+// StreamVByte-style: two-bit byte lengths packed into control bytes followed by the value
+// bytes, decoded four values per SSSE3 shuffle where the CPU has it. The viewed memory is
+// owned elsewhere, by a PostingList or a mapped index segment.
+class PostingListView {
+public:
+    static constexpr std::size_t block_size = 128;
+
+    PostingListView() = default;
+    PostingListView(const PostingBlock* blocks, std::size_t block_count, const std::uint8_t* data,
+                    const Posting* tail, std::size_t tail_size, std::size_t size);
+
+    template <typename Visitor>
+    void ForEachInRange(std::uint32_t first, std::uint32_t last, Visitor visitor) const;
+
+    template <typename Visitor>
+    void ForEach(Visitor visitor) const;
+
+    std::size_t size() const;
+    bool empty() const;
+
+    static void EncodeBlock(const Posting* postings, std::size_t count, std::vector<std::uint8_t>& out);
+    // Bytes of the control bytes of a block of count postings, and of the whole block encoded
+    // at data, which only its control bytes are read for.
+    static std::size_t GetControlSize(std::size_t count);
+    static std::size_t GetEncodedBlockSize(const std::uint8_t* data, std::size_t count);
+
+private:
+    friend class PostingList;
+    friend class PostingListCursor;
+
+    const PostingBlock* blocks_ = nullptr;
+    std::size_t block_count_ = 0;
+    const std::uint8_t* data_ = nullptr;
+    const Posting* tail_ = nullptr;
+    std::size_t tail_size_ = 0;
+    std::size_t size_ = 0;
+
+    // The tail is addressed as block block_count_.
+    std::size_t GetBlockCount() const;
+    std::size_t FindBlock(std::uint32_t ordinal) const;
+    std::size_t DecodeBlock(std::size_t block_index, Posting* postings) const;
+
+    static void DecodeBlock(const std::uint8_t* data, std::uint32_t first_ordinal, std::size_t count,
+                            Posting* postings);
+};
+
+// Forward iterator over a PostingListView that decodes one block at a time.
+class PostingListCursor {
+public:
+    explicit PostingListCursor(const PostingListView& postings);
+
+    bool IsEnd() const;
+    const Posting& operator*() const;
+    const Posting* operator->() const;
+
+    void Next();
+    // Moves to the first posting whose ordinal is not less than ordinal.
+    void SkipTo(std::uint32_t ordinal);
+
+private:
+    PostingListView postings_;
+    std::size_t block_index_ = 0;
+    std::size_t position_ = 0;
+    std::size_t block_length_ = 0;
+    std::array<Posting, PostingListView::block_size> block_;
+
+    void LoadBlock(std::size_t block_index);
+};
+
+// Growable posting list. The newest postings stay uncompressed in a tail until a block fills up.
+class PostingList {
+public:
+    static constexpr std::size_t block_size = PostingListView::block_size;
+
+    void Append(Posting posting);
+
+    // Compresses the tail as a final, possibly short, block.
+    void Seal();
+
+    PostingListView GetView() const;
+
+    const std::vector<PostingBlock>& GetBlocks() const;
+    const std::vector<std::uint8_t>& GetData() const;
+
+    std::size_t size() const;
+    bool empty() const;
+
+private:
+    std::vector<PostingBlock> blocks_;
+    std::vector<std::uint8_t> data_;
+    std::vector<Posting> tail_;
+    std::size_t size_ = 0;
+
+    void FlushTail();
+};
+
+template <typename Visitor>
+void PostingListView::ForEachInRange(std::uint32_t first, std::uint32_t last, Visitor visitor) const {
+    std::array<Posting, block_size> block;
+    for (std::size_t block_index = FindBlock(first); block_index < GetBlockCount(); ++block_index) {
+        const std::size_t length = DecodeBlock(block_index, block.data());
+        for (std::size_t i = 0; i < length; ++i) {
+            if (block[i].ordinal >= last) {
+                return;
+            }
+            if (block[i].ordinal >= first) {
+                visitor(block[i]);
+            }
+        }
+    }
+}
+
+template <typename Visitor>
+void PostingListView::ForEach(Visitor visitor) const {
+    ForEachInRange(0, UINT32_MAX, visitor);
+}
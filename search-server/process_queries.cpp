@@ -4,26 +4,25 @@
 std::vector<std::vector<Document>> ProcessQueries(
     const SearchServer& search_server,
     const std::vector<std::string>& queries) {
-    std::vector<std::vector<Document>> documents(queries.size());
-    std::transform(std::execution::par,
-                    queries.begin(), queries.end(),
-                    documents.begin(),
-                    [&search_server](const std::string& query) {
-                        return search_server.FindTopDocuments(query);
-    });
-    return documents;
+    return search_server.FindTopDocumentsBatch(std::execution::par, queries);
+}
+
+std::vector<std::vector<Document>> ProcessQueries(
+    ThreadPool& thread_pool,
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries) {
+    return search_server.FindTopDocumentsBatch(thread_pool, queries);
+}
+
+std::vector<Document> ProcessQueriesJoined(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries) {
+    return search_server.FindTopDocumentsBatchJoined(std::execution::par, queries).documents;
 }
 
 std::vector<Document> ProcessQueriesJoined(
+    ThreadPool& thread_pool,
     const SearchServer& search_server,
     const std::vector<std::string>& queries) {
-    std::vector<Document> result;
-    result.reserve(queries.size());
-    auto documents = ProcessQueries(search_server, queries);
-    for (size_t i = 0; i != documents.size(); ++i) {
-        for (const Document& document : documents[i]) {
-            result.push_back(document);
-        }
-    }
-    return result;
+    return search_server.FindTopDocumentsBatchJoined(thread_pool, queries).documents;
 }
\ No newline at end of file
@@ -0,0 +1,78 @@
+#include "query_result_cache.h"
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+void QueryResultCache::SetCapacity(std::size_t capacity) {
+    capacity_ = capacity;
+    used_shard_count_ = std::clamp<std::size_t>(capacity, 1, shard_count_);
+    for (std::size_t i = 0; i < shard_count_; ++i) {
+        Shard& shard = shards_[i];
+        std::lock_guard guard(shard.mutex);
+        shard.capacity = i < used_shard_count_
+                         ? capacity / used_shard_count_ + (i < capacity % used_shard_count_ ? 1 : 0)
+                         : 0;
+        shard.index.clear();
+        shard.entries.clear();
+        shard.stats = {};
+    }
+}
+
+std::size_t QueryResultCache::GetCapacity() const {
+    return capacity_;
+}
+
+QueryCacheStats QueryResultCache::GetStats() const {
+    QueryCacheStats stats;
+    for (const Shard& shard : shards_) {
+        std::lock_guard guard(shard.mutex);
+        stats.hit_count += shard.stats.hit_count;
+        stats.miss_count += shard.stats.miss_count;
+    }
+    return stats;
+}
+
+std::optional<std::vector<Document>> QueryResultCache::Find(std::string_view key, std::uint64_t generation) {
+    Shard& shard = GetShard(key);
+    std::lock_guard guard(shard.mutex);
+    const auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        ++shard.stats.miss_count;
+        return std::nullopt;
+    }
+    const auto entry = it->second;
+    if (entry->generation != generation) {
+        shard.index.erase(it);
+        shard.entries.erase(entry);
+        ++shard.stats.miss_count;
+        return std::nullopt;
+    }
+    shard.entries.splice(shard.entries.begin(), shard.entries, entry);
+    ++shard.stats.hit_count;
+    return entry->documents;
+}
+
+void QueryResultCache::Insert(std::string key, std::uint64_t generation, std::vector<Document> documents) {
+    Shard& shard = GetShard(key);
+    std::lock_guard guard(shard.mutex);
+    if (shard.capacity == 0) {
+        return;
+    }
+    if (const auto it = shard.index.find(key); it != shard.index.end()) {
+        it->second->generation = generation;
+        it->second->documents = std::move(documents);
+        shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+        return;
+    }
+    shard.entries.push_front({std::move(key), generation, std::move(documents)});
+    shard.index.emplace(shard.entries.front().key, shard.entries.begin());
+    if (shard.entries.size() > shard.capacity) {
+        shard.index.erase(shard.entries.back().key);
+        shard.entries.pop_back();
+    }
+}
+
+QueryResultCache::Shard& QueryResultCache::GetShard(std::string_view key) {
+    return shards_[std::hash<std::string_view>{}(key) % used_shard_count_];
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "document.h"
+
+#include <array>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Lookups counted since caching was last configured.
+struct QueryCacheStats {
+    std::uint64_t hit_count = 0;
+    std::uint64_t miss_count = 0;
+};
+
+// Results of recent queries keyed by normalized query text, evicted least recently used
+// first. Keys are spread over shards with their own locks, so concurrent queries rarely
+// contend. An entry stored for an older index generation is dropped when found.
+class QueryResultCache {
+public:
+    // Drops every entry and resets the statistics; 0 disables caching. The shard capacities
+    // add up to capacity, and a capacity below the shard count uses that many shards.
+    void SetCapacity(std::size_t capacity);
+    std::size_t GetCapacity() const;
+
+    QueryCacheStats GetStats() const;
+
+    std::optional<std::vector<Document>> Find(std::string_view key, std::uint64_t generation);
+    void Insert(std::string key, std::uint64_t generation, std::vector<Document> documents);
+
+private:
+    static constexpr std::size_t shard_count_ = 16;
+
+    struct Entry {
+        std::string key;
+        std::uint64_t generation;
+        std::vector<Document> documents;
+    };
+    // Entries are ordered from the most recently used; the index keys view their strings.
+    struct Shard {
+        mutable std::mutex mutex;
+        std::size_t capacity = 0;
+        std::list<Entry> entries;
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+        QueryCacheStats stats;
+    };
+
+    std::size_t capacity_ = 0;
+    std::size_t used_shard_count_ = 1;
+    std::array<Shard, shard_count_> shards_;
+
+    Shard& GetShard(std::string_view key);
+};
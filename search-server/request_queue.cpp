@@ -3,42 +3,49 @@
 RequestQueue::RequestQueue(const SearchServer& search_server)
     : search_server_(search_server)
     , no_results_requests_(0)
+    , cache_hit_requests_(0)
     , current_time_(0) {
 }
 
-template <typename DocumentPredicate>
-std::vector<Document> RequestQueue::AddFindRequest(std::string_view raw_query, DocumentPredicate document_predicate) {
-    const auto result = search_server_.FindTopDocuments(raw_query, document_predicate);
-    AddRequest(result.size());
-    return result;
-}
-
 std::vector<Document> RequestQueue::AddFindRequest(std::string_view raw_query, DocumentStatus status) {
-    const auto result = search_server_.FindTopDocuments(raw_query, status);
-    AddRequest(result.size());
+    bool is_cache_hit = false;
+    const auto result = search_server_.FindTopDocuments(raw_query, status, is_cache_hit);
+    AddRequest(result.size(), is_cache_hit);
     return result;
 }
 
 std::vector<Document> RequestQueue::AddFindRequest(std::string_view raw_query) {
-    const auto result = search_server_.FindTopDocuments(raw_query);
-    AddRequest(result.size());
-    return result;
+    return AddFindRequest(raw_query, DocumentStatus::ACTUAL);
 }
 
 int RequestQueue::GetNoResultRequests() const {
     return no_results_requests_;
 }
 
-void RequestQueue::AddRequest(int results_num) {
+int RequestQueue::GetCacheHitRequests() const {
+    return cache_hit_requests_;
+}
+
+double RequestQueue::GetCacheHitRate() const {
+    return requests_.empty() ? 0.0 : cache_hit_requests_ * 1.0 / requests_.size();
+}
+
+void RequestQueue::AddRequest(int results_num, bool is_cache_hit) {
     ++current_time_;
     while (!requests_.empty() && min_in_day_ <= current_time_ - requests_.front().timestamp) {
         if (0 == requests_.front().results) {
             --no_results_requests_;
         }
+        if (requests_.front().is_cache_hit) {
+            --cache_hit_requests_;
+        }
         requests_.pop_front();
     }
-    requests_.push_back({current_time_, results_num});
+    requests_.push_back({current_time_, results_num, is_cache_hit});
     if (0 == results_num) {
         ++no_results_requests_;
     }
+    if (is_cache_hit) {
+        ++cache_hit_requests_;
+    }
 }
\ No newline at end of file
@@ -18,16 +18,29 @@ public:
 
     int GetNoResultRequests() const;
 
+    // Requests of the last day answered from the server's query cache.
+    int GetCacheHitRequests() const;
+    double GetCacheHitRate() const;
+
 private:
     struct QueryResult {
         std::uint64_t timestamp;
         int results;
+        bool is_cache_hit;
     };
     std::deque<QueryResult> requests_;
     const SearchServer& search_server_;
     int no_results_requests_;
+    int cache_hit_requests_;
     std::uint64_t current_time_;
     const static int min_in_day_ = 1440;
 
-    void AddRequest(int results_num);
-};
\ No newline at end of file
+    void AddRequest(int results_num, bool is_cache_hit);
+};
+
+template <typename DocumentPredicate>
+std::vector<Document> RequestQueue::AddFindRequest(std::string_view raw_query, DocumentPredicate document_predicate) {
+    const auto result = search_server_.FindTopDocuments(raw_query, document_predicate);
+    AddRequest(result.size(), false);
+    return result;
+}
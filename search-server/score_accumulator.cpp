@@ -0,0 +1,38 @@
+#include "score_accumulator.h"
+
+void ScoreAccumulator::Resize(std::size_t ordinal_count) {
+    if (scores_.size() < ordinal_count) {
+        scores_.resize(ordinal_count, 0.0);
+        states_.resize(ordinal_count, SlotState::EMPTY);
+    }
+}
+
+void ScoreAccumulator::Add(std::uint32_t ordinal, double score) {
+    switch (states_[ordinal]) {
+    case SlotState::EMPTY:
+        states_[ordinal] = SlotState::SCORED;
+        scores_[ordinal] = score;
+        touched_.push_back(ordinal);
+        break;
+    case SlotState::SCORED:
+        scores_[ordinal] += score;
+        break;
+    case SlotState::EXCLUDED:
+        break;
+    }
+}
+
+void ScoreAccumulator::Exclude(std::uint32_t ordinal) {
+    if (states_[ordinal] == SlotState::EMPTY) {
+        touched_.push_back(ordinal);
+    }
+    states_[ordinal] = SlotState::EXCLUDED;
+}
+
+void ScoreAccumulator::Clear() {
+    for (const std::uint32_t ordinal : touched_) {
+        states_[ordinal] = SlotState::EMPTY;
+        scores_[ordinal] = 0.0;
+    }
+    touched_.clear();
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// Dense relevance accumulator indexed by document ordinal. Only touched slots are reset
+// by Clear, so one instance is reused across queries without reallocating.
+class ScoreAccumulator {
+public:
+    void Resize(std::size_t ordinal_count);
+
+    void Add(std::uint32_t ordinal, double score);
+
+    // Excluded ordinals ignore later Add calls and are skipped by ForEachScored.
+    void Exclude(std::uint32_t ordinal);
+
+    template <typename Visitor>
+    void ForEachScored(Visitor visitor) const;
+
+    void Clear();
+
+private:
+    enum class SlotState : std::uint8_t {
+        EMPTY,
+        SCORED,
+        EXCLUDED,
+    };
+    std::vector<double> scores_;
+    std::vector<SlotState> states_;
+    std::vector<std::uint32_t> touched_;
+};
+
+template <typename Visitor>
+void ScoreAccumulator::ForEachScored(Visitor visitor) const {
+    for (const std::uint32_t ordinal : touched_) {
+        if (states_[ordinal] == SlotState::SCORED) {
+            visitor(ordinal, scores_[ordinal]);
+        }
+    }
+}
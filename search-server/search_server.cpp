@@ -10,42 +10,275 @@ SearchServer::SearchServer(std::string_view stop_words_text)
 {
 }
 
+SearchServer::SearchServer(std::shared_ptr<const IndexSegment> segment)
+    : SearchServer(segment->GetStopWords())
+{
+    const int* ids = segment->GetDocumentIds();
+    document_ids_.assign(ids, ids + segment->GetDocumentCount());
+    std::sort(document_ids_.begin(), document_ids_.end());
+    if (std::adjacent_find(document_ids_.begin(), document_ids_.end()) != document_ids_.end()) {
+        throw std::invalid_argument("Invalid document_id");
+    }
+    document_count_ = document_ids_.size();
+    AttachSegment(std::move(segment));
+}
+
+SearchServer::SearchServer(const std::set<std::string, std::less<>>& stop_words,
+                           std::vector<SegmentState> segments, std::vector<int> document_ids)
+    : SearchServer(stop_words)
+{
+    segments_ = std::move(segments);
+    for (SegmentState& state : segments_) {
+        state.inverse_document_freqs.Resize(state.segment->GetTermCount());
+    }
+    document_ids_ = std::move(document_ids);
+    document_count_ = document_ids_.size();
+}
+
 void SearchServer::AddDocument(int document_id, std::string_view document, DocumentStatus status,
                      const std::vector<int>& ratings) {
-    if ((document_id < 0) || (documents_.count(document_id) > 0)) {
+    if ((document_id < 0) || FindDocument(document_id)) {
         throw std::invalid_argument("Invalid document_id");
     }
-    buffer_.emplace_back(document);
-    std::vector<std::string_view> words;
-    if (!buffer_.empty()){
-        words = SplitIntoWordsNoStop(buffer_.back());
-    }
+    std::vector<std::string_view> words = SplitIntoWordsNoStop(document);
+    InstallMergeIfReady();
+    ++generation_;
     const double inv_word_count = 1.0 / words.size();
-    for (std::string_view word : words) {
-        word_to_document_freqs_[word][document_id] += inv_word_count;
-        freqs_of_document_words_[document_id][word] += inv_word_count;
+    const std::uint32_t ordinal = static_cast<std::uint32_t>(documents_.ids.size());
+    documents_.ids.push_back(document_id);
+    documents_.ratings.push_back(ComputeAverageRating(ratings));
+    documents_.statuses.push_back(status);
+    ++documents_.status_counts[static_cast<std::size_t>(status)];
+    documents_.inv_word_counts.push_back(inv_word_count);
+    documents_.is_removed.push_back(false);
+    GrowAttributes(documents_.attributes, documents_.ids.size());
+    document_ordinals_.emplace(document_id, ordinal);
+
+    std::sort(words.begin(), words.end());
+    const std::size_t first_term = documents_.term_ids.size();
+    for (auto it = words.begin(); it != words.end();) {
+        const auto word_end = std::find_if(it, words.end(), [it](std::string_view word) { return word != *it; });
+        const TermId term_id = terms_.Intern(*it);
+        documents_.term_ids.push_back(term_id);
+        const bool is_new_term = term_id == term_postings_.size();
+        if (is_new_term) {
+            term_postings_.emplace_back();
+            memory_inverse_document_freqs_.Resize(term_postings_.size());
+        }
+        auto& [postings, max_term_freq, removed_count] = term_postings_[term_id];
+        if (!is_new_term && postings.size() == removed_count) {
+            --dead_term_count_;
+        }
+        const Posting posting{ordinal, static_cast<std::uint32_t>(word_end - it)};
+        postings.Append(posting);
+        max_term_freq = std::max(max_term_freq, posting.term_count * inv_word_count);
+        it = word_end;
+    }
+    std::sort(documents_.term_ids.begin() + first_term, documents_.term_ids.end());
+    documents_.term_offsets.push_back(documents_.term_ids.size());
+    AddDocumentId(document_id);
+    if (flush_threshold_ > 0 && document_ordinals_.size() >= flush_threshold_) {
+        Flush();
+    }
+}
+
+void SearchServer::AddDocuments(const std::vector<NewDocument>& documents) {
+    SearchServer::AddDocuments(std::execution::seq, documents);
+}
+
+void SearchServer::AddDocuments(const std::execution::sequenced_policy& policy,
+                                const std::vector<NewDocument>& documents) {
+    AddDocumentBatch(policy, documents);
+}
+
+void SearchServer::AddDocuments(const std::execution::parallel_policy& policy,
+                                const std::vector<NewDocument>& documents) {
+    AddDocumentBatch(policy, documents);
+}
+
+template <typename ExecutionPolicy>
+void SearchServer::AddDocumentBatch(const ExecutionPolicy& policy, const std::vector<NewDocument>& documents) {
+    // A word is invalid exactly when the text has a control character, so checking whole
+    // texts up front keeps the batch all-or-nothing.
+    std::vector<int> batch_ids;
+    batch_ids.reserve(documents.size());
+    for (const NewDocument& document : documents) {
+        if (document.id < 0 || FindDocument(document.id)) {
+            throw std::invalid_argument("Invalid document_id");
+        }
+        batch_ids.push_back(document.id);
+    }
+    std::sort(batch_ids.begin(), batch_ids.end());
+    if (std::adjacent_find(batch_ids.begin(), batch_ids.end()) != batch_ids.end()) {
+        throw std::invalid_argument("Invalid document_id");
+    }
+    std::vector<char> is_valid(documents.size());
+    ForEachIndex(GetExecutor(policy), documents.size(), [&](std::size_t i) {
+        is_valid[i] = IsValidWord(documents[i].text);
+    });
+    if (std::find(is_valid.begin(), is_valid.end(), false) != is_valid.end()) {
+        throw std::invalid_argument("Some of documents have invalid words"s);
+    }
+
+    InstallMergeIfReady();
+    ++generation_;
+    const NewDocument* first = documents.data();
+    const NewDocument* last = documents.data() + documents.size();
+    while (first != last) {
+        std::size_t slice_size = last - first;
+        if (flush_threshold_ > 0) {
+            slice_size = std::min(slice_size, flush_threshold_ - std::min(flush_threshold_, document_ordinals_.size()));
+            slice_size = std::max<std::size_t>(slice_size, 1);
+        }
+        IndexDocuments(policy, first, first + slice_size);
+        first += slice_size;
+        if (flush_threshold_ > 0 && document_ordinals_.size() >= flush_threshold_) {
+            Flush();
+        }
+    }
+}
+
+// Partitioned inversion. Documents are split into chunks of consecutive ordinals; each chunk
+// is tokenized into (term, ordinal, count) runs. New words are interned between the
+// parallel passes, the only step that touches the dictionary. Each chunk then distributes
+// its runs over term partitions, and every task appends the postings of one partition from
+// all chunks in chunk order, which keeps each posting list sorted by ordinal without locks.
+template <typename ExecutionPolicy>
+void SearchServer::IndexDocuments(const ExecutionPolicy& policy, const NewDocument* first,
+                                  const NewDocument* last) {
+    struct WordRun {
+        std::string_view word;
+        TermId term_id;
+        std::uint32_t ordinal;
+        std::uint32_t term_count;
+    };
+    struct Chunk {
+        std::size_t first;
+        std::size_t last;
+        std::vector<WordRun> runs;
+        std::vector<std::string_view> new_words;
+        // Runs split by term id modulo the partition count, each still in ordinal order.
+        std::vector<std::vector<WordRun>> partitions;
+        // Forward index of the chunk: the sorted term ids of each document in turn.
+        std::vector<TermId> term_ids;
+        std::vector<std::size_t> term_counts;
+    };
+
+    const std::size_t document_count = last - first;
+    const std::uint32_t first_ordinal = static_cast<std::uint32_t>(documents_.ids.size());
+    for (const NewDocument* document = first; document != last; ++document) {
+        documents_.ids.push_back(document->id);
+        documents_.ratings.push_back(ComputeAverageRating(document->ratings));
+        documents_.statuses.push_back(document->status);
+        ++documents_.status_counts[static_cast<std::size_t>(document->status)];
+        documents_.inv_word_counts.push_back(0.0);
+        documents_.is_removed.push_back(false);
+    }
+    GrowAttributes(documents_.attributes, documents_.ids.size());
+
+    ThreadPool* executor = GetExecutor(policy);
+    const std::size_t chunk_count = std::min<std::size_t>((executor ? executor->GetConcurrency() : 1) * 4,
+                                                          document_count);
+    std::vector<Chunk> chunks(chunk_count);
+    for (std::size_t i = 0; i < chunk_count; ++i) {
+        chunks[i].first = document_count * i / chunk_count;
+        chunks[i].last = document_count * (i + 1) / chunk_count;
+    }
+    ForEachIndex(executor, chunk_count, [&](std::size_t chunk_index) {
+        Chunk& chunk = chunks[chunk_index];
+        std::vector<std::string_view> words;
+        for (std::size_t i = chunk.first; i < chunk.last; ++i) {
+            const std::uint32_t ordinal = first_ordinal + static_cast<std::uint32_t>(i);
+            words = SplitIntoWordsNoStop(first[i].text);
+            const double inv_word_count = 1.0 / words.size();
+            documents_.inv_word_counts[ordinal] = inv_word_count;
+            std::sort(words.begin(), words.end());
+            for (auto it = words.begin(); it != words.end();) {
+                const auto word_end = std::find_if(it, words.end(), [it](std::string_view word) { return word != *it; });
+                const auto term_count = static_cast<std::uint32_t>(word_end - it);
+                const auto term_id = terms_.Find(*it);
+                if (!term_id) {
+                    chunk.new_words.push_back(*it);
+                }
+                chunk.runs.push_back({*it, term_id.value_or(0), ordinal, term_count});
+                it = word_end;
+            }
+        }
+    });
+
+    const std::size_t old_term_count = terms_.size();
+    for (const Chunk& chunk : chunks) {
+        for (std::string_view word : chunk.new_words) {
+            terms_.Intern(word);
+        }
+    }
+    term_postings_.resize(terms_.size());
+    memory_inverse_document_freqs_.Resize(terms_.size());
+    const std::size_t partition_count = chunk_count;
+    ForEachIndex(executor, chunk_count, [&](std::size_t chunk_index) {
+        Chunk& chunk = chunks[chunk_index];
+        chunk.partitions.resize(partition_count);
+        chunk.term_counts.assign(chunk.last - chunk.first, 0);
+        for (WordRun& run : chunk.runs) {
+            if (!chunk.new_words.empty()) {
+                run.term_id = *terms_.Find(run.word);
+            }
+            chunk.term_ids.push_back(run.term_id);
+            ++chunk.term_counts[run.ordinal - first_ordinal - chunk.first];
+            chunk.partitions[run.term_id % partition_count].push_back(run);
+        }
+        chunk.runs = {};
+        auto document_terms = chunk.term_ids.begin();
+        for (const std::size_t term_count : chunk.term_counts) {
+            std::sort(document_terms, document_terms + term_count);
+            document_terms += term_count;
+        }
+    });
+    for (const Chunk& chunk : chunks) {
+        documents_.term_ids.insert(documents_.term_ids.end(), chunk.term_ids.begin(), chunk.term_ids.end());
+        for (const std::size_t term_count : chunk.term_counts) {
+            documents_.term_offsets.push_back(documents_.term_offsets.back() + term_count);
+        }
+    }
+
+    std::vector<std::size_t> revived_term_counts(partition_count, 0);
+    ForEachIndex(executor, partition_count, [&](std::size_t partition) {
+        for (const Chunk& chunk : chunks) {
+            for (const WordRun& run : chunk.partitions[partition]) {
+                auto& [postings, max_term_freq, removed_count] = term_postings_[run.term_id];
+                if (postings.size() == removed_count && run.term_id < old_term_count) {
+                    ++revived_term_counts[partition];
+                }
+                postings.Append({run.ordinal, run.term_count});
+                max_term_freq = std::max(max_term_freq, run.term_count * documents_.inv_word_counts[run.ordinal]);
+            }
+        }
+    });
+
+    dead_term_count_ -= std::accumulate(revived_term_counts.begin(), revived_term_counts.end(), std::size_t{0});
+
+    for (std::size_t i = 0; i < document_count; ++i) {
+        const int document_id = first[i].id;
+        document_ordinals_.emplace(document_id, first_ordinal + static_cast<std::uint32_t>(i));
+        AddDocumentId(document_id);
     }
-    documents_.emplace(document_id, DocumentData{ComputeAverageRating(ratings), status});
-    document_ids_.insert(document_id);
 }
 
 std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status) const {
     return SearchServer::FindTopDocuments(std::execution::seq, raw_query, status);
 }
 
-std::vector<Document> SearchServer::FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, DocumentStatus status) const {
-    return SearchServer::FindTopDocuments(
-        raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-            return document_status == status;
-        });
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::sequenced_policy& policy, std::string_view raw_query, DocumentStatus status) const {
+    return FindTopDocumentsByStatus(policy, raw_query, status, nullptr);
 }
 
-std::vector<Document> SearchServer::FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query, DocumentStatus status) const {
-    return SearchServer::FindTopDocuments(
-        std::execution::par,
-        raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-            return document_status == status;
-        });
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::parallel_policy& policy, std::string_view raw_query, DocumentStatus status) const {
+    return FindTopDocumentsByStatus(policy, raw_query, status, nullptr);
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+                                                     bool& is_cache_hit) const {
+    return FindTopDocumentsByStatus(std::execution::seq, raw_query, status, &is_cache_hit);
 }
 
 std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query) const {
@@ -60,23 +293,335 @@ std::vector<Document> SearchServer::FindTopDocuments(const std::execution::paral
     return SearchServer::FindTopDocuments(std::execution::par, raw_query, DocumentStatus::ACTUAL);
 }
 
+std::vector<std::vector<Document>> SearchServer::FindTopDocumentsBatch(const std::vector<std::string>& raw_queries) const {
+    return SearchServer::FindTopDocumentsBatch(std::execution::par, raw_queries);
+}
+
+std::vector<std::vector<Document>> SearchServer::FindTopDocumentsBatch(const std::execution::sequenced_policy& policy,
+                                                                      const std::vector<std::string>& raw_queries) const {
+    std::vector<std::vector<Document>> results(raw_queries.size());
+    FindTopDocumentsInBatch(policy, raw_queries, [&results](std::size_t query_index, TopDocuments& top_documents) {
+        results[query_index] = top_documents.Release();
+    });
+    return results;
+}
+
+std::vector<std::vector<Document>> SearchServer::FindTopDocumentsBatch(const std::execution::parallel_policy& policy,
+                                                                      const std::vector<std::string>& raw_queries) const {
+    std::vector<std::vector<Document>> results(raw_queries.size());
+    FindTopDocumentsInBatch(policy, raw_queries, [&results](std::size_t query_index, TopDocuments& top_documents) {
+        results[query_index] = top_documents.Release();
+    });
+    return results;
+}
+
+BatchResults SearchServer::FindTopDocumentsBatchJoined(const std::vector<std::string>& raw_queries) const {
+    return SearchServer::FindTopDocumentsBatchJoined(std::execution::par, raw_queries);
+}
+
+BatchResults SearchServer::FindTopDocumentsBatchJoined(const std::execution::sequenced_policy& policy,
+                                                       const std::vector<std::string>& raw_queries) const {
+    return FindJoinedTopDocumentsInBatch(policy, raw_queries);
+}
+
+BatchResults SearchServer::FindTopDocumentsBatchJoined(const std::execution::parallel_policy& policy,
+                                                       const std::vector<std::string>& raw_queries) const {
+    return FindJoinedTopDocumentsInBatch(policy, raw_queries);
+}
+
+std::vector<std::vector<Document>> SearchServer::FindTopDocumentsBatch(ThreadPool& thread_pool,
+                                                                      const std::vector<std::string>& raw_queries) const {
+    std::vector<std::vector<Document>> results(raw_queries.size());
+    FindTopDocumentsInBatch(ThreadPoolPolicy{&thread_pool}, raw_queries,
+                            [&results](std::size_t query_index, TopDocuments& top_documents) {
+        results[query_index] = top_documents.Release();
+    });
+    return results;
+}
+
+BatchResults SearchServer::FindTopDocumentsBatchJoined(ThreadPool& thread_pool,
+                                                       const std::vector<std::string>& raw_queries) const {
+    return FindJoinedTopDocumentsInBatch(ThreadPoolPolicy{&thread_pool}, raw_queries);
+}
+
+// Every query writes into its own fixed-size slot of the buffer as soon as it is scored;
+// one sequential pass then packs the slots to the front in query order.
+template <typename ExecutionPolicy>
+BatchResults SearchServer::FindJoinedTopDocumentsInBatch(const ExecutionPolicy& policy,
+                                                        const std::vector<std::string>& raw_queries) const {
+    const std::size_t slot_size = std::min<std::size_t>(max_result_document_count_, GetDocumentCount());
+    BatchResults results;
+    results.documents.resize(raw_queries.size() * slot_size);
+    std::vector<std::size_t> counts(raw_queries.size(), 0);
+    FindTopDocumentsInBatch(policy, raw_queries, [&](std::size_t query_index, TopDocuments& top_documents) {
+        counts[query_index] = top_documents.ReleaseTo(results.documents.data() + query_index * slot_size);
+    });
+
+    results.offsets.resize(raw_queries.size() + 1, 0);
+    for (std::size_t i = 0; i < raw_queries.size(); ++i) {
+        const auto slot = results.documents.begin() + i * slot_size;
+        std::copy(slot, slot + counts[i], results.documents.begin() + results.offsets[i]);
+        results.offsets[i + 1] = results.offsets[i] + counts[i];
+    }
+    results.documents.resize(results.offsets.back());
+    return results;
+}
+
+// Queries are parsed up front into indexes of the batch's distinct words, which are then
+// resolved in parallel into one table of per-source matches. Queries are ordered by their
+// longest posting list and scored in contiguous runs, each run by one task.
+template <typename ExecutionPolicy, typename ResultWriter>
+void SearchServer::FindTopDocumentsInBatch(const ExecutionPolicy& policy, const std::vector<std::string>& raw_queries,
+                                           ResultWriter write_results) const {
+    struct BatchQuery {
+        std::vector<std::uint32_t> plus_words;
+        std::vector<std::uint32_t> minus_words;
+    };
+
+    std::vector<BatchQuery> queries(raw_queries.size());
+    std::vector<std::string_view> words;
+    std::unordered_map<std::string_view, std::uint32_t> word_indexes;
+    const auto index_word = [&words, &word_indexes](std::string_view word) {
+        const auto [it, is_new] = word_indexes.emplace(word, static_cast<std::uint32_t>(words.size()));
+        if (is_new) {
+            words.push_back(word);
+        }
+        return it->second;
+    };
+    Query& query = GetThreadQuery();
+    for (std::size_t i = 0; i < raw_queries.size(); ++i) {
+        ParseQuery(raw_queries[i], query, true);
+        for (std::string_view word : query.plus_words) {
+            queries[i].plus_words.push_back(index_word(word));
+        }
+        for (std::string_view word : query.minus_words) {
+            queries[i].minus_words.push_back(index_word(word));
+        }
+    }
+    if (max_result_document_count_ == 0) {
+        return;
+    }
+
+    const std::size_t source_count = GetSourceCount();
+    std::vector<std::optional<TermMatch>> matches(words.size() * source_count);
+    std::vector<std::optional<double>> inverse_document_freqs(words.size());
+    std::vector<std::size_t> posting_counts(words.size(), 0);
+    ThreadPool* executor = GetExecutor(policy);
+    ForEachIndex(executor, words.size(), [&](std::size_t word) {
+        const auto word_matches = matches.begin() + word * source_count;
+        inverse_document_freqs[word] = ResolveTerm(words[word], &*word_matches);
+        for (auto match = word_matches; match != word_matches + source_count; ++match) {
+            if (*match) {
+                posting_counts[word] += (*match)->postings.size();
+            }
+        }
+    });
+
+    const std::uint32_t no_word = std::numeric_limits<std::uint32_t>::max();
+    std::vector<std::uint32_t> longest_words(queries.size(), no_word);
+    for (std::size_t i = 0; i < queries.size(); ++i) {
+        for (const std::uint32_t word : queries[i].plus_words) {
+            if (longest_words[i] == no_word || posting_counts[word] > posting_counts[longest_words[i]]) {
+                longest_words[i] = word;
+            }
+        }
+    }
+    std::vector<std::size_t> order(queries.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&longest_words](std::size_t lhs, std::size_t rhs) {
+        return longest_words[lhs] < longest_words[rhs];
+    });
+
+    const StatusPredicate document_predicate{DocumentStatus::ACTUAL};
+    const auto resolve_query = [&](const BatchQuery& batch_query, std::vector<SourceQuery>& source_queries) {
+        ResetSourceQueries(source_queries);
+        for (const std::uint32_t word : batch_query.plus_words) {
+            if (inverse_document_freqs[word]) {
+                AddPlusWord(&matches[word * source_count], *inverse_document_freqs[word], source_queries);
+            }
+        }
+        for (const std::uint32_t word : batch_query.minus_words) {
+            AddMinusWord(&matches[word * source_count], source_queries);
+        }
+    };
+    if (executor && batch_parallelism_ == BatchParallelism::INTRA_QUERY) {
+        std::vector<SourceQuery> source_queries;
+        TopDocuments top_documents(max_result_document_count_);
+        for (const std::size_t query_index : order) {
+            resolve_query(queries[query_index], source_queries);
+            ScoreSourceQueriesInRanges(*executor, source_queries, document_predicate, top_documents);
+            write_results(query_index, top_documents);
+        }
+        return;
+    }
+    const std::size_t run_count = std::min<std::size_t>((executor ? executor->GetConcurrency() : 1) * 4,
+                                                        queries.size());
+    ForEachIndex(executor, run_count, [&](std::size_t run) {
+        std::vector<SourceQuery> source_queries;
+        TopDocuments top_documents(max_result_document_count_);
+        for (std::size_t position = queries.size() * run / run_count;
+             position < queries.size() * (run + 1) / run_count; ++position) {
+            const BatchQuery& batch_query = queries[order[position]];
+            resolve_query(batch_query, source_queries);
+            ScoreSourceQueries(source_queries, document_predicate, top_documents);
+            write_results(order[position], top_documents);
+        }
+    });
+}
+
 int SearchServer::GetDocumentCount() const {
-    return documents_.size();
+    return document_count_;
+}
+
+bool SearchServer::HasDocument(int document_id) const {
+    return FindDocument(document_id).has_value();
+}
+
+void SearchServer::SetMaxResultDocumentCount(std::size_t max_count) {
+    max_result_document_count_ = max_count;
 }
 
-std::set<int>::const_iterator SearchServer::begin() const {
-    return document_ids_.begin();
+std::size_t SearchServer::GetMaxResultDocumentCount() const {
+    return max_result_document_count_;
 }
-std::set<int>::const_iterator SearchServer::end() const {
-    return document_ids_.end();
+
+void SearchServer::SetQueryCacheCapacity(std::size_t capacity) {
+    synchronized_->query_cache.SetCapacity(capacity);
+}
+
+QueryCacheStats SearchServer::GetQueryCacheStats() const {
+    return synchronized_->query_cache.GetStats();
+}
+
+void SearchServer::SetThreadPool(std::shared_ptr<ThreadPool> thread_pool) {
+    thread_pool_ = std::move(thread_pool);
+}
+
+void SearchServer::SetBatchParallelism(BatchParallelism parallelism) {
+    batch_parallelism_ = parallelism;
+}
+
+ThreadPool* SearchServer::GetExecutor(const std::execution::sequenced_policy&) const {
+    return nullptr;
+}
+
+ThreadPool* SearchServer::GetExecutor(const std::execution::parallel_policy&) const {
+    return thread_pool_ ? thread_pool_.get() : &ThreadPool::GetDefault();
+}
+
+ThreadPool* SearchServer::GetExecutor(const ThreadPoolPolicy& policy) {
+    return policy.thread_pool;
+}
+
+std::vector<int>::const_iterator SearchServer::begin() const {
+    return GetDocumentIds().begin();
+}
+std::vector<int>::const_iterator SearchServer::end() const {
+    return GetDocumentIds().end();
+}
+
+std::size_t SearchServer::AddAttributeColumn(std::string_view name) {
+    if (FindAttributeColumn(name)) {
+        throw std::invalid_argument("Attribute column exists");
+    }
+    attribute_names_.emplace_back(name);
+    documents_.attributes.push_back({std::vector<std::int64_t>(documents_.ids.size(), 0)});
+    for (SegmentState& state : segments_) {
+        state.attributes.push_back({std::vector<std::int64_t>(state.segment->GetDocumentCount(), 0)});
+    }
+    return attribute_names_.size() - 1;
+}
+
+std::optional<std::size_t> SearchServer::FindAttributeColumn(std::string_view name) const {
+    const auto it = std::find(attribute_names_.begin(), attribute_names_.end(), name);
+    if (it == attribute_names_.end()) {
+        return std::nullopt;
+    }
+    return it - attribute_names_.begin();
+}
+
+void SearchServer::SetAttribute(int document_id, std::size_t column, std::int64_t value) {
+    const auto location = FindDocument(document_id);
+    if (document_id < 0 || !location) {
+        throw std::out_of_range("Invalid document_id");
+    }
+    if (column >= attribute_names_.size()) {
+        throw std::out_of_range("Invalid attribute column");
+    }
+    std::vector<AttributeColumn>& columns = location->source_index == segments_.size()
+                                            ? documents_.attributes
+                                            : segments_[location->source_index].attributes;
+    AttributeColumn& attribute = columns[column];
+    attribute.values[location->ordinal] = value;
+    attribute.min_value = std::min(attribute.min_value, value);
+    attribute.max_value = std::max(attribute.max_value, value);
+}
+
+std::int64_t SearchServer::GetAttribute(int document_id, std::size_t column) const {
+    const auto location = FindDocument(document_id);
+    if (document_id < 0 || !location) {
+        throw std::out_of_range("Invalid document_id");
+    }
+    if (column >= attribute_names_.size()) {
+        throw std::out_of_range("Invalid attribute column");
+    }
+    return (*GetSource(location->source_index).attributes)[column].values[location->ordinal];
 }
 
 const std::map<std::string_view, double>& SearchServer::GetWordFrequencies(int document_id) const {
     static const std::map<std::string_view, double> empty_map;
-    if (freqs_of_document_words_.find(document_id) != freqs_of_document_words_.end()) {
-        return freqs_of_document_words_.at(document_id);
+    const auto location = FindDocument(document_id);
+    if (!location) {
+        return empty_map;
+    }
+
+    std::lock_guard guard(synchronized_->word_freqs_mutex);
+    const auto [freqs_it, is_new] = synchronized_->freqs_of_document_words.try_emplace(document_id);
+    if (!is_new) {
+        return freqs_it->second;
     }
-    return empty_map;
+    auto& words = synchronized_->word_freqs_words;
+    const auto add_word = [&words, &word_freqs = freqs_it->second](std::string_view word, double freq) {
+        auto word_it = words.find(word);
+        if (word_it == words.end()) {
+            word_it = words.emplace(word, 0).first;
+        }
+        ++word_it->second;
+        word_freqs.emplace(word_it->first, freq);
+    };
+    const std::uint32_t ordinal = location->ordinal;
+    if (location->source_index == segments_.size()) {
+        for (std::size_t i = documents_.term_offsets[ordinal]; i < documents_.term_offsets[ordinal + 1]; ++i) {
+            const TermId term_id = documents_.term_ids[i];
+            PostingListCursor cursor(term_postings_[term_id].postings.GetView());
+            cursor.SkipTo(ordinal);
+            add_word(terms_.GetWord(term_id), cursor->term_count * documents_.inv_word_counts[ordinal]);
+        }
+    } else {
+        const IndexSegment& segment = *segments_[location->source_index].segment;
+        const double inv_word_count = segment.GetInvWordCounts()[ordinal];
+        const auto [first, last] = segment.GetForwardEntries(ordinal);
+        for (auto entry = first; entry != last; ++entry) {
+            add_word(segment.GetWord(entry->term_id), entry->term_count * inv_word_count);
+        }
+    }
+    return freqs_it->second;
+}
+
+void SearchServer::EraseWordFrequencies(int document_id) {
+    std::lock_guard guard(synchronized_->word_freqs_mutex);
+    const auto freqs_it = synchronized_->freqs_of_document_words.find(document_id);
+    if (freqs_it == synchronized_->freqs_of_document_words.end()) {
+        return;
+    }
+    auto& words = synchronized_->word_freqs_words;
+    for (const auto& [word, freq] : freqs_it->second) {
+        const auto word_it = words.find(word);
+        if (--word_it->second == 0) {
+            words.erase(word_it);
+        }
+    }
+    synchronized_->freqs_of_document_words.erase(freqs_it);
 }
 
 void SearchServer::RemoveDocument(int document_id) {
@@ -84,38 +629,19 @@ void SearchServer::RemoveDocument(int document_id) {
 }
 
 void SearchServer::RemoveDocument(const std::execution::sequenced_policy&, int document_id) {
-    if (documents_.count(document_id) == 0) return;
-
-    for (const auto& [word, freq] : GetWordFrequencies(document_id)) {
-        word_to_document_freqs_[word].erase(document_id);
+    InstallMergeIfReady();
+    const auto ordinal_it = document_ordinals_.find(document_id);
+    if (ordinal_it == document_ordinals_.end()) {
+        RemoveSegmentDocument(document_id);
+        return;
     }
-    documents_.erase(document_id);
-    document_ids_.erase(document_id);
-    freqs_of_document_words_.erase(document_id);
+    RemoveMemoryDocument(document_id, ordinal_it->second);
 }
 
+// Removal only marks the document and updates per-term counters, so there is no work
+// worth splitting across threads.
 void SearchServer::RemoveDocument(const std::execution::parallel_policy&, int document_id) {
-    if (documents_.count(document_id) == 0) return;
-
-    const auto& words_freqs = GetWordFrequencies(document_id);
-    std::vector<std::string_view> words(words_freqs.size());
-    std::transform(
-        std::execution::par,
-        words_freqs.begin(), words_freqs.end(),
-        words.begin(),
-        [](const auto& item) {
-            return item.first;
-    });
-    std::for_each(
-        std::execution::par,
-        words.begin(), words.end(),
-        [this, document_id](std::string_view word) {
-            word_to_document_freqs_[word].erase(document_id);
-    });
-
-    documents_.erase(document_id);
-    document_ids_.erase(document_id);
-    freqs_of_document_words_.erase(document_id);
+    SearchServer::RemoveDocument(std::execution::seq, document_id);
 }
 
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(std::string_view raw_query,
@@ -123,64 +649,164 @@ std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDoc
     return SearchServer::MatchDocument(std::execution::seq, raw_query, document_id);
 }
 
-std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::sequenced_policy&,
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::sequenced_policy& policy,
                                                                                     std::string_view raw_query, int document_id) const {
+    std::vector<std::string_view> matched_words;
+    const DocumentStatus status = MatchDocument(policy, raw_query, document_id, matched_words);
+    return {std::move(matched_words), status};
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::parallel_policy& policy,
+                                                                                    std::string_view raw_query, int document_id)  const {
+    std::vector<std::string_view> matched_words;
+    const DocumentStatus status = MatchDocument(policy, raw_query, document_id, matched_words);
+    return {std::move(matched_words), status};
+}
+
+DocumentStatus SearchServer::MatchDocument(std::string_view raw_query, int document_id,
+                                           std::vector<std::string_view>& matched_words) const {
+    return SearchServer::MatchDocument(std::execution::seq, raw_query, document_id, matched_words);
+}
+
+DocumentStatus SearchServer::MatchDocument(const std::execution::sequenced_policy& policy, std::string_view raw_query,
+                                           int document_id, std::vector<std::string_view>& matched_words) const {
+    return MatchDocumentWords(GetExecutor(policy), raw_query, document_id, matched_words);
+}
+
+DocumentStatus SearchServer::MatchDocument(const std::execution::parallel_policy& policy, std::string_view raw_query,
+                                           int document_id, std::vector<std::string_view>& matched_words) const {
+    return MatchDocumentWords(GetExecutor(policy), raw_query, document_id, matched_words);
+}
+
+// A word costs a dictionary lookup and a binary search of the document's terms, far less
+// than handing a task to another thread, so only queries with enough words to keep several
+// threads busy are split.
+DocumentStatus SearchServer::MatchDocumentWords(ThreadPool* executor, std::string_view raw_query, int document_id,
+                                                std::vector<std::string_view>& matched_words) const {
     if (!IsValidWord(raw_query)) {
         throw std::invalid_argument("Invalid query");
     }
-    if (document_id < 0 || documents_.count(document_id) == 0) {
+    const auto location = FindDocument(document_id);
+    if (document_id < 0 || !location) {
         throw std::out_of_range("Invalid document_id");
     }
 
-    const auto query = ParseQuery(raw_query, true);
-    std::vector<std::string_view> matched_words;
-    for (const std::string_view& word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
+    const DocumentStatus status = GetSource(location->source_index).statuses[location->ordinal];
+    Query& query = GetThreadQuery();
+    ParseQuery(raw_query, query, true);
+    matched_words.clear();
+
+    const std::size_t min_steps_per_task = 1 << 14;
+    const std::size_t plus_word_count = query.plus_words.size();
+    const std::size_t word_count = plus_word_count + query.minus_words.size();
+    const std::size_t steps_per_word = 16 + static_cast<std::size_t>(std::log2(GetTermCount(*location) + 1.0));
+    const std::size_t task_count = executor == nullptr
+                                   ? 1 : std::min(executor->GetConcurrency(), word_count * steps_per_word / min_steps_per_task);
+    if (task_count <= 1) {
+        for (const std::string_view& word : query.minus_words) {
+            if (HasWord(*location, word)) {
+                return status;
+            }
         }
-        if (word_to_document_freqs_.at(word).count(document_id)) {
-            return std::make_tuple(std::vector<std::string_view>{}, documents_.at(document_id).status);
+        for (const std::string_view& word : query.plus_words) {
+            if (HasWord(*location, word)) {
+                matched_words.push_back(word);
+            }
         }
+        return status;
     }
-    for (const std::string_view& word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
+
+    // Moved out of the thread's buffers, which the calling thread may reuse for other queries
+    // while it waits, and moved back once done.
+    Query shared_query = std::move(query);
+    std::vector<char> has_word(word_count);
+    executor->ParallelFor(task_count, [&](std::size_t task) {
+        for (std::size_t i = word_count * task / task_count; i < word_count * (task + 1) / task_count; ++i) {
+            has_word[i] = HasWord(*location, i < plus_word_count ? shared_query.plus_words[i]
+                                                                 : shared_query.minus_words[i - plus_word_count]);
         }
-        if (word_to_document_freqs_.at(word).count(document_id)) {
-            matched_words.push_back(word);
+    });
+    if (std::find(has_word.begin() + plus_word_count, has_word.end(), true) == has_word.end()) {
+        for (std::size_t i = 0; i < plus_word_count; ++i) {
+            if (has_word[i]) {
+                matched_words.push_back(shared_query.plus_words[i]);
+            }
         }
     }
-    return {matched_words, documents_.at(document_id).status};
+    query = std::move(shared_query);
+    return status;
 }
-std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::parallel_policy&,
-                                                                                    std::string_view raw_query, int document_id)  const {
+
+std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> SearchServer::MatchDocuments(
+        std::string_view raw_query, const std::vector<int>& document_ids) const {
+    return SearchServer::MatchDocuments(std::execution::seq, raw_query, document_ids);
+}
+
+std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> SearchServer::MatchDocuments(
+        const std::execution::sequenced_policy& policy, std::string_view raw_query,
+        const std::vector<int>& document_ids) const {
+    return MatchDocumentsInBatch(policy, raw_query, document_ids);
+}
+
+std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> SearchServer::MatchDocuments(
+        const std::execution::parallel_policy& policy, std::string_view raw_query,
+        const std::vector<int>& document_ids) const {
+    return MatchDocumentsInBatch(policy, raw_query, document_ids);
+}
+
+// Query words become term ids once per source, so matching a document takes a binary search
+// of its forward index per word instead of dictionary lookups.
+template <typename ExecutionPolicy>
+std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> SearchServer::MatchDocumentsInBatch(
+        const ExecutionPolicy& policy, std::string_view raw_query, const std::vector<int>& document_ids) const {
     if (!IsValidWord(raw_query)) {
         throw std::invalid_argument("Invalid query");
     }
-    if (document_id < 0 || documents_.count(document_id) == 0) {
-        throw std::out_of_range("Invalid document_id");
+    std::vector<DocumentLocation> locations;
+    locations.reserve(document_ids.size());
+    for (const int document_id : document_ids) {
+        const auto location = FindDocument(document_id);
+        if (document_id < 0 || !location) {
+            throw std::out_of_range("Invalid document_id");
+        }
+        locations.push_back(*location);
     }
 
-    const auto query = ParseQuery(raw_query);
-    const auto& words_freqs = GetWordFrequencies(document_id);
-    if (std::any_of(
-                    std::execution::par,
-                    query.minus_words.begin(), query.minus_words.end(),
-                    [&words_freqs](std::string_view word) { return words_freqs.count(word); }))
-        return std::make_tuple(std::vector<std::string_view>{}, documents_.at(document_id).status);
-
-    std::vector<std::string_view> matched_words(query.plus_words.size());
-    auto it_end = std::copy_if(
-                std::execution::par,
-                query.plus_words.begin(), query.plus_words.end(),
-                matched_words.begin(),
-                [&words_freqs](std::string_view word) { return words_freqs.count(word); });
-
-    std::sort(matched_words.begin(), it_end);
-    auto last = std::unique(matched_words.begin(), it_end);
-    matched_words.erase(last, matched_words.end());
+    // Not the thread's buffers: document tasks read the query from other threads.
+    Query query;
+    ParseQuery(raw_query, query, true);
+    const std::size_t plus_word_count = query.plus_words.size();
+    const std::size_t word_count = plus_word_count + query.minus_words.size();
+    // Per source, the term ids of the plus words and then of the minus words.
+    std::vector<std::optional<TermId>> term_ids(GetSourceCount() * word_count);
+    for (std::size_t source_index = 0; source_index < GetSourceCount(); ++source_index) {
+        for (std::size_t i = 0; i < word_count; ++i) {
+            const std::string_view word = i < plus_word_count ? query.plus_words[i]
+                                                              : query.minus_words[i - plus_word_count];
+            term_ids[source_index * word_count + i] = source_index == segments_.size()
+                                                      ? terms_.Find(word)
+                                                      : segments_[source_index].segment->FindTerm(word);
+        }
+    }
 
-    return { matched_words, documents_.at(document_id).status };
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> results(document_ids.size());
+    ForEachIndex(GetExecutor(policy), document_ids.size(), [&](std::size_t document_index) {
+        const DocumentLocation& location = locations[document_index];
+        auto& [matched_words, status] = results[document_index];
+        status = GetSource(location.source_index).statuses[location.ordinal];
+        const auto source_term_ids = term_ids.begin() + location.source_index * word_count;
+        for (std::size_t i = plus_word_count; i < word_count; ++i) {
+            if (source_term_ids[i] && HasTerm(location, *source_term_ids[i])) {
+                return;
+            }
+        }
+        for (std::size_t i = 0; i < plus_word_count; ++i) {
+            if (source_term_ids[i] && HasTerm(location, *source_term_ids[i])) {
+                matched_words.push_back(query.plus_words[i]);
+            }
+        }
+    });
+    return results;
 }
 
 bool SearchServer::IsStopWord(std::string_view word) const {
@@ -188,20 +814,28 @@ bool SearchServer::IsStopWord(std::string_view word) const {
 }
 
 bool SearchServer::IsValidWord(std::string_view word) {
-    return std::none_of(word.begin(), word.end(), [](char c) {
-        return c >= '\0' && c < ' ';
+    return !HasControlChars(word);
+}
+
+std::string_view SearchServer::FindInvalidWord(std::string_view text) {
+    std::string_view invalid_word;
+    ForEachWord(text, [&invalid_word](std::string_view word) {
+        if (invalid_word.empty() && !IsValidWord(word)) {
+            invalid_word = word;
+        }
     });
+    return invalid_word;
 }
 
 std::vector<std::string_view> SearchServer::SplitIntoWordsNoStop(std::string_view text) const {
     std::vector<std::string_view> words;
-    for (const std::string_view& word : SplitIntoWords(text)) {
-        if (!IsValidWord(word)) {
-            throw std::invalid_argument("Word "s + static_cast<std::string>(word) + " is invalid"s);
-        }
+    const bool is_valid = ForEachWord(text, [this, &words](std::string_view word) {
         if (!IsStopWord(word)) {
             words.push_back(word);
         }
+    });
+    if (!is_valid) {
+        throw std::invalid_argument("Word "s + static_cast<std::string>(FindInvalidWord(text)) + " is invalid"s);
     }
     return words;
 }
@@ -214,6 +848,55 @@ int SearchServer::ComputeAverageRating(const std::vector<int>& ratings) {
     return rating_sum / static_cast<int>(ratings.size());
 }
 
+const std::vector<int>& SearchServer::GetDocumentIds() const {
+    std::lock_guard guard(synchronized_->document_ids_mutex);
+    if (!added_document_ids_.empty()) {
+        std::sort(added_document_ids_.begin(), added_document_ids_.end());
+        const std::size_t merged_count = document_ids_.size();
+        document_ids_.insert(document_ids_.end(), added_document_ids_.begin(), added_document_ids_.end());
+        std::inplace_merge(document_ids_.begin(), document_ids_.begin() + merged_count, document_ids_.end());
+        added_document_ids_.clear();
+    }
+    if (!removed_document_ids_.empty()) {
+        // An id removed and added again is in document_ids_ twice by now and removed once.
+        std::sort(removed_document_ids_.begin(), removed_document_ids_.end());
+        auto removed = removed_document_ids_.begin();
+        std::size_t live_count = 0;
+        for (std::size_t i = 0; i < document_ids_.size(); ++i) {
+            if (removed != removed_document_ids_.end() && *removed == document_ids_[i]) {
+                ++removed;
+            } else {
+                document_ids_[live_count++] = document_ids_[i];
+            }
+        }
+        document_ids_.resize(live_count);
+        removed_document_ids_.clear();
+    }
+    return document_ids_;
+}
+
+void SearchServer::AddDocumentId(int document_id) {
+    added_document_ids_.push_back(document_id);
+    ++document_count_;
+    MergeDocumentIdsIfNeeded();
+}
+
+void SearchServer::RemoveDocumentId(int document_id) {
+    removed_document_ids_.push_back(document_id);
+    --document_count_;
+    MergeDocumentIdsIfNeeded();
+}
+
+// Merging once pending ids outnumber the merged ones keeps changes amortized logarithmic
+// even if nobody iterates.
+void SearchServer::MergeDocumentIdsIfNeeded() {
+    const std::size_t min_pending_count = 1024;
+    if (added_document_ids_.size() + removed_document_ids_.size()
+        > std::max(document_ids_.size(), min_pending_count)) {
+        GetDocumentIds();
+    }
+}
+
 SearchServer::QueryWord SearchServer::ParseQueryWord(std::string_view text) const {
     if (text.empty()) {
         throw std::invalid_argument("Query word is empty"s);
@@ -224,15 +907,16 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(std::string_view text) cons
         is_minus = true;
         word = word.substr(1);
     }
-    if (word.empty() || word[0] == '-' || !IsValidWord(word)) {
+    if (word.empty() || word[0] == '-') {
         throw std::invalid_argument("Query word "s + static_cast<std::string>(text) + " is invalid");
     }
     return {word, is_minus, IsStopWord(word)};
 }
 
-SearchServer::Query SearchServer::ParseQuery(std::string_view text, bool remove_duplicates) const {
-    Query result;
-    for (std::string_view word : SplitIntoWords(text)) {
+void SearchServer::ParseQuery(std::string_view text, Query& result, bool remove_duplicates) const {
+    result.plus_words.clear();
+    result.minus_words.clear();
+    const bool is_valid = ForEachWord(text, [this, &result](std::string_view word) {
         const auto query_word = ParseQueryWord(word);
         if (!query_word.is_stop) {
             if (query_word.is_minus) {
@@ -241,6 +925,9 @@ SearchServer::Query SearchServer::ParseQuery(std::string_view text, bool remove_
                 result.plus_words.push_back(query_word.data);
             }
         }
+    });
+    if (!is_valid) {
+        throw std::invalid_argument("Query word "s + static_cast<std::string>(FindInvalidWord(text)) + " is invalid");
     }
     if (remove_duplicates == true) {
         std::sort(result.plus_words.begin(), result.plus_words.end());
@@ -251,9 +938,596 @@ SearchServer::Query SearchServer::ParseQuery(std::string_view text, bool remove_
         auto last_minus_words = std::unique(result.minus_words.begin(), result.minus_words.end());
         result.minus_words.erase(last_minus_words, result.minus_words.end());
     }
-    return result;
 }
 
-double SearchServer::ComputeWordInverseDocumentFreq(std::string_view word) const {
-    return std::log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
-}
\ No newline at end of file
+SearchServer::Query& SearchServer::GetThreadQuery() {
+    static thread_local Query query;
+    return query;
+}
+
+// Words never contain spaces and plus words never start with '-', so the key is unambiguous.
+void SearchServer::MakeQueryCacheKey(const Query& query, DocumentStatus status, std::string& key) const {
+    key.clear();
+    key += std::to_string(static_cast<int>(status));
+    key += ' ';
+    key += std::to_string(max_result_document_count_);
+    for (std::string_view word : query.plus_words) {
+        key += ' ';
+        key += word;
+    }
+    for (std::string_view word : query.minus_words) {
+        key += " -"s;
+        key += word;
+    }
+}
+
+ScoreAccumulator& SearchServer::GetThreadAccumulator() {
+    static thread_local ScoreAccumulator accumulator;
+    return accumulator;
+}
+
+void SearchServer::AttachSegment(std::shared_ptr<const IndexSegment> segment) {
+    SegmentState state;
+    state.is_removed.assign(segment->GetDocumentCount(), false);
+    state.removed_term_counts.assign(segment->GetTermCount(), 0);
+    state.inverse_document_freqs.Resize(segment->GetTermCount());
+    state.status_counts = CountStatuses(*segment);
+    state.attributes = MakeAttributeColumns(segment->GetDocumentCount());
+    state.segment = std::move(segment);
+    segments_.push_back(std::move(state));
+}
+
+SearchServer::StatusCounts SearchServer::CountStatuses(const IndexSegment& segment) {
+    StatusCounts status_counts = {};
+    const DocumentStatus* statuses = segment.GetStatuses();
+    for (std::size_t ordinal = 0; ordinal < segment.GetDocumentCount(); ++ordinal) {
+        ++status_counts[static_cast<std::size_t>(statuses[ordinal])];
+    }
+    return status_counts;
+}
+
+std::vector<SearchServer::AttributeColumn> SearchServer::MakeAttributeColumns(std::size_t ordinal_count) const {
+    return std::vector<AttributeColumn>(attribute_names_.size(),
+                                        AttributeColumn{std::vector<std::int64_t>(ordinal_count, 0)});
+}
+
+void SearchServer::GrowAttributes(std::vector<AttributeColumn>& columns, std::size_t ordinal_count) {
+    for (AttributeColumn& column : columns) {
+        column.values.resize(ordinal_count, 0);
+        column.min_value = std::min<std::int64_t>(column.min_value, 0);
+        column.max_value = std::max<std::int64_t>(column.max_value, 0);
+    }
+}
+
+void SearchServer::ComputeBounds(AttributeColumn& column) {
+    column.min_value = 0;
+    column.max_value = 0;
+    if (!column.values.empty()) {
+        const auto [min_it, max_it] = std::minmax_element(column.values.begin(), column.values.end());
+        column.min_value = *min_it;
+        column.max_value = *max_it;
+    }
+}
+
+void SearchServer::CopyAttributes(const SourceView& source, SegmentState& state) {
+    if (state.attributes.empty()) {
+        return;
+    }
+    for (std::uint32_t ordinal = 0; ordinal < source.ordinal_count; ++ordinal) {
+        if (IsRemoved(source, ordinal)) {
+            continue;
+        }
+        const std::uint32_t new_ordinal = *state.segment->FindOrdinal(source.ids[ordinal]);
+        for (std::size_t column = 0; column < state.attributes.size(); ++column) {
+            state.attributes[column].values[new_ordinal] = (*source.attributes)[column].values[ordinal];
+        }
+    }
+    for (AttributeColumn& column : state.attributes) {
+        ComputeBounds(column);
+    }
+}
+
+std::size_t SearchServer::GetSourceCount() const {
+    return segments_.size() + 1;
+}
+
+SearchServer::SourceView SearchServer::GetSource(std::size_t source_index) const {
+    if (source_index == segments_.size()) {
+        return {documents_.ids.data(), documents_.ratings.data(), documents_.statuses.data(),
+                documents_.inv_word_counts.data(), static_cast<std::uint32_t>(documents_.ids.size()),
+                &documents_.is_removed, &documents_.status_counts, &documents_.attributes};
+    }
+    const SegmentState& state = segments_[source_index];
+    const IndexSegment& segment = *state.segment;
+    return {segment.GetDocumentIds(), segment.GetRatings(), segment.GetStatuses(), segment.GetInvWordCounts(),
+            static_cast<std::uint32_t>(segment.GetDocumentCount()), &state.is_removed, &state.status_counts,
+            &state.attributes};
+}
+
+bool SearchServer::IsRemoved(const SourceView& source, std::uint32_t ordinal) {
+    return (*source.is_removed)[ordinal];
+}
+
+double SearchServer::ComputeTermFreq(const SourceView& source, const Posting& posting) {
+    return posting.term_count * source.inv_word_counts[posting.ordinal];
+}
+
+std::optional<SearchServer::DocumentLocation> SearchServer::FindDocument(int document_id) const {
+    const auto ordinal_it = document_ordinals_.find(document_id);
+    if (ordinal_it != document_ordinals_.end()) {
+        return DocumentLocation{segments_.size(), ordinal_it->second};
+    }
+    for (std::size_t i = 0; i < segments_.size(); ++i) {
+        const auto ordinal = segments_[i].segment->FindOrdinal(document_id);
+        if (ordinal && !segments_[i].is_removed[*ordinal]) {
+            return DocumentLocation{i, *ordinal};
+        }
+    }
+    return std::nullopt;
+}
+
+bool SearchServer::HasWord(const DocumentLocation& location, std::string_view word) const {
+    const auto term_id = location.source_index == segments_.size()
+                         ? terms_.Find(word)
+                         : segments_[location.source_index].segment->FindTerm(word);
+    return term_id && HasTerm(location, *term_id);
+}
+
+std::size_t SearchServer::GetTermCount(const DocumentLocation& location) const {
+    if (location.source_index == segments_.size()) {
+        return documents_.term_offsets[location.ordinal + 1] - documents_.term_offsets[location.ordinal];
+    }
+    const auto [first, last] = segments_[location.source_index].segment->GetForwardEntries(location.ordinal);
+    return last - first;
+}
+
+bool SearchServer::HasTerm(const DocumentLocation& location, TermId term_id) const {
+    if (location.source_index == segments_.size()) {
+        const auto first = documents_.term_ids.begin() + documents_.term_offsets[location.ordinal];
+        const auto last = documents_.term_ids.begin() + documents_.term_offsets[location.ordinal + 1];
+        return std::binary_search(first, last, term_id);
+    }
+    const auto [first, last] = segments_[location.source_index].segment->GetForwardEntries(location.ordinal);
+    const auto it = std::lower_bound(first, last, term_id, [](const IndexSegment::ForwardEntry& entry, TermId id) {
+        return entry.term_id < id;
+    });
+    return it != last && it->term_id == term_id;
+}
+
+void SearchServer::RemoveSegmentDocument(int document_id) {
+    const auto location = FindDocument(document_id);
+    if (!location) {
+        return;
+    }
+    ++generation_;
+    MarkRemoved(segments_[location->source_index], location->ordinal);
+    RemoveDocumentId(document_id);
+    EraseWordFrequencies(document_id);
+}
+
+void SearchServer::MarkRemoved(SegmentState& state, std::uint32_t ordinal) {
+    state.is_removed[ordinal] = true;
+    ++state.removed_count;
+    const auto [first, last] = state.segment->GetForwardEntries(ordinal);
+    for (auto entry = first; entry != last; ++entry) {
+        ++state.removed_term_counts[entry->term_id];
+    }
+}
+
+std::optional<SearchServer::TermMatch> SearchServer::FindTerm(std::size_t source_index, std::string_view word) const {
+    if (source_index == segments_.size()) {
+        const auto term_id = terms_.Find(word);
+        if (!term_id) {
+            return std::nullopt;
+        }
+        const TermPostings& term_postings = term_postings_[*term_id];
+        const std::size_t document_freq = term_postings.postings.size() - term_postings.removed_count;
+        if (document_freq == 0) {
+            return std::nullopt;
+        }
+        return TermMatch{*term_id, term_postings.postings.GetView(), term_postings.max_term_freq, document_freq};
+    }
+    const SegmentState& state = segments_[source_index];
+    const auto term_id = state.segment->FindTerm(word);
+    if (!term_id) {
+        return std::nullopt;
+    }
+    const PostingListView postings = state.segment->GetPostings(*term_id);
+    const std::size_t document_freq = postings.size() - state.removed_term_counts[*term_id];
+    if (document_freq == 0) {
+        return std::nullopt;
+    }
+    return TermMatch{*term_id, postings, state.segment->GetMaxTermFreq(*term_id), document_freq};
+}
+
+const InverseDocumentFreqCache& SearchServer::GetInverseDocumentFreqs(std::size_t source_index) const {
+    if (source_index == segments_.size()) {
+        return memory_inverse_document_freqs_;
+    }
+    return segments_[source_index].inverse_document_freqs;
+}
+
+// Postings of removed documents stay in place and are skipped during scoring.
+void SearchServer::RemoveMemoryDocument(int document_id, std::uint32_t ordinal) {
+    ++generation_;
+    documents_.is_removed[ordinal] = true;
+    ++documents_.removed_count;
+    for (std::size_t i = documents_.term_offsets[ordinal]; i < documents_.term_offsets[ordinal + 1]; ++i) {
+        TermPostings& term_postings = term_postings_[documents_.term_ids[i]];
+        if (++term_postings.removed_count == term_postings.postings.size()) {
+            ++dead_term_count_;
+        }
+    }
+    document_ordinals_.erase(document_id);
+    RemoveDocumentId(document_id);
+    EraseWordFrequencies(document_id);
+    PurgeRemovedDocumentsIfNeeded();
+}
+
+// Once removed documents make up a quarter of the in-memory index, or dead terms half of
+// its dictionary, rebuilds it without them: live documents get dense ordinals, posting
+// lists are re-encoded and dead terms leave the dictionary. Word frequency maps own their
+// words, so they are left alone.
+void SearchServer::PurgeRemovedDocumentsIfNeeded() {
+    const std::size_t min_purge_count = 1024;
+    const bool has_removed_documents = documents_.removed_count >= min_purge_count
+                                       && documents_.removed_count * 4 >= documents_.ids.size();
+    const bool has_dead_terms = dead_term_count_ >= min_purge_count && dead_term_count_ * 2 >= terms_.size();
+    if (!has_removed_documents && !has_dead_terms) {
+        return;
+    }
+
+    const std::uint32_t no_ordinal = std::numeric_limits<std::uint32_t>::max();
+    std::vector<std::uint32_t> new_ordinals(documents_.ids.size(), no_ordinal);
+    DocumentColumns documents;
+    documents.attributes = MakeAttributeColumns(0);
+    for (std::uint32_t ordinal = 0; ordinal < new_ordinals.size(); ++ordinal) {
+        if (!documents_.is_removed[ordinal]) {
+            new_ordinals[ordinal] = static_cast<std::uint32_t>(documents.ids.size());
+            documents.ids.push_back(documents_.ids[ordinal]);
+            documents.ratings.push_back(documents_.ratings[ordinal]);
+            documents.statuses.push_back(documents_.statuses[ordinal]);
+            ++documents.status_counts[static_cast<std::size_t>(documents_.statuses[ordinal])];
+            documents.inv_word_counts.push_back(documents_.inv_word_counts[ordinal]);
+            documents.is_removed.push_back(false);
+            documents.term_ids.insert(documents.term_ids.end(),
+                                      documents_.term_ids.begin() + documents_.term_offsets[ordinal],
+                                      documents_.term_ids.begin() + documents_.term_offsets[ordinal + 1]);
+            documents.term_offsets.push_back(documents.term_ids.size());
+            for (std::size_t column = 0; column < documents.attributes.size(); ++column) {
+                documents.attributes[column].values.push_back(documents_.attributes[column].values[ordinal]);
+            }
+        }
+    }
+    for (AttributeColumn& column : documents.attributes) {
+        ComputeBounds(column);
+    }
+    for (auto& [document_id, ordinal] : document_ordinals_) {
+        ordinal = new_ordinals[ordinal];
+    }
+
+    TermDictionary terms;
+    std::vector<TermPostings> term_postings;
+    term_postings.reserve(terms_.size() - dead_term_count_);
+    // Live terms keep their order, so renumbered forward index entries stay sorted.
+    std::vector<TermId> new_term_ids(terms_.size());
+    for (TermId term_id = 0; term_id < terms_.size(); ++term_id) {
+        const TermPostings& old_postings = term_postings_[term_id];
+        if (old_postings.postings.size() == old_postings.removed_count) {
+            continue;
+        }
+        new_term_ids[term_id] = terms.Intern(terms_.GetWord(term_id));
+        auto& [postings, max_term_freq, removed_count] = term_postings.emplace_back();
+        old_postings.postings.GetView().ForEach([&](const Posting& posting) {
+            const std::uint32_t ordinal = new_ordinals[posting.ordinal];
+            if (ordinal != no_ordinal) {
+                postings.Append({ordinal, posting.term_count});
+                max_term_freq = std::max(max_term_freq, posting.term_count * documents.inv_word_counts[ordinal]);
+            }
+        });
+    }
+    for (TermId& term_id : documents.term_ids) {
+        term_id = new_term_ids[term_id];
+    }
+    documents_ = std::move(documents);
+    terms_ = std::move(terms);
+    term_postings_ = std::move(term_postings);
+    memory_inverse_document_freqs_ = InverseDocumentFreqCache(terms_.size());
+    dead_term_count_ = 0;
+}
+
+void SearchServer::ResolveQuery(const Query& query, std::vector<SourceQuery>& source_queries) const {
+    ResetSourceQueries(source_queries);
+    static thread_local std::vector<std::optional<TermMatch>> matches;
+    matches.resize(GetSourceCount());
+    for (const std::string_view& word : query.plus_words) {
+        if (const auto inverse_document_freq = ResolveTerm(word, matches.data())) {
+            AddPlusWord(matches.data(), *inverse_document_freq, source_queries);
+        }
+    }
+    for (const std::string_view& word : query.minus_words) {
+        FindTermInSources(word, matches.data());
+        AddMinusWord(matches.data(), source_queries);
+    }
+}
+
+void SearchServer::ResolveQuery(const Query& query, const std::vector<std::optional<double>>& inverse_document_freqs,
+                                std::vector<SourceQuery>& source_queries) const {
+    ResetSourceQueries(source_queries);
+    static thread_local std::vector<std::optional<TermMatch>> matches;
+    matches.resize(GetSourceCount());
+    for (std::size_t i = 0; i < query.plus_words.size(); ++i) {
+        if (inverse_document_freqs[i]) {
+            FindTermInSources(query.plus_words[i], matches.data());
+            AddPlusWord(matches.data(), *inverse_document_freqs[i], source_queries);
+        }
+    }
+    for (const std::string_view& word : query.minus_words) {
+        FindTermInSources(word, matches.data());
+        AddMinusWord(matches.data(), source_queries);
+    }
+}
+
+std::size_t SearchServer::FindTermInSources(std::string_view word, std::optional<TermMatch>* matches) const {
+    std::size_t document_freq = 0;
+    for (std::size_t i = 0; i < GetSourceCount(); ++i) {
+        matches[i] = FindTerm(i, word);
+        if (matches[i]) {
+            document_freq += matches[i]->document_freq;
+        }
+    }
+    return document_freq;
+}
+
+std::map<std::string_view, std::size_t> SearchServer::GetDocumentFreqs(std::string_view raw_query) const {
+    Query query;
+    ParseQuery(raw_query, query, true);
+    std::map<std::string_view, std::size_t> document_freqs;
+    for (std::string_view word : query.plus_words) {
+        document_freqs.emplace(word, GetDocumentFreq(word));
+    }
+    return document_freqs;
+}
+
+std::size_t SearchServer::GetDocumentFreq(std::string_view word) const {
+    std::size_t document_freq = 0;
+    for (std::size_t i = 0; i < GetSourceCount(); ++i) {
+        if (const auto match = FindTerm(i, word)) {
+            document_freq += match->document_freq;
+        }
+    }
+    return document_freq;
+}
+
+std::optional<double> SearchServer::ResolveTerm(std::string_view word, std::optional<TermMatch>* matches) const {
+    const std::size_t source_count = GetSourceCount();
+    const std::size_t document_freq = FindTermInSources(word, matches);
+    if (document_freq == 0) {
+        return std::nullopt;
+    }
+    const std::size_t first_match = std::find_if(matches, matches + source_count,
+                                                 [](const auto& match) { return match.has_value(); }) - matches;
+    const InverseDocumentFreqCache& cache = GetInverseDocumentFreqs(first_match);
+    const TermId term_id = matches[first_match]->term_id;
+    if (const auto cached = cache.Find(term_id, generation_)) {
+        return *cached;
+    }
+    const double inverse_document_freq = std::log(GetDocumentCount() * 1.0 / document_freq);
+    cache.Store(term_id, generation_, inverse_document_freq);
+    return inverse_document_freq;
+}
+
+void SearchServer::ResetSourceQueries(std::vector<SourceQuery>& source_queries) const {
+    const std::size_t source_count = GetSourceCount();
+    source_queries.resize(source_count);
+    for (std::size_t i = 0; i < source_count; ++i) {
+        source_queries[i].source = GetSource(i);
+        source_queries[i].plus_words.clear();
+        source_queries[i].minus_words.clear();
+    }
+}
+
+void SearchServer::AddPlusWord(const std::optional<TermMatch>* matches, double inverse_document_freq,
+                               std::vector<SourceQuery>& source_queries) {
+    for (std::size_t i = 0; i < source_queries.size(); ++i) {
+        if (matches[i]) {
+            source_queries[i].plus_words.push_back({matches[i]->postings, inverse_document_freq,
+                                                    matches[i]->max_term_freq * inverse_document_freq});
+        }
+    }
+}
+
+void SearchServer::AddMinusWord(const std::optional<TermMatch>* matches, std::vector<SourceQuery>& source_queries) {
+    for (std::size_t i = 0; i < source_queries.size(); ++i) {
+        if (matches[i]) {
+            source_queries[i].minus_words.push_back(matches[i]->postings);
+        }
+    }
+}
+
+void SearchServer::SaveSegment(const std::string& path) const {
+    SegmentBuilder builder;
+    builder.SetStopWords(stop_words_);
+    for (const SegmentState& state : segments_) {
+        AppendSegment(builder, state);
+    }
+    AppendMemoryIndex(builder);
+    builder.Write(path);
+}
+
+void SearchServer::SetFlushThreshold(std::size_t document_count) {
+    flush_threshold_ = document_count;
+}
+
+void SearchServer::Flush() {
+    InstallMergeIfReady();
+    if (documents_.ids.empty()) {
+        return;
+    }
+    SegmentBuilder builder;
+    builder.SetStopWords(stop_words_);
+    AppendMemoryIndex(builder);
+    const SourceView memory_source = GetSource(segments_.size());
+    AttachSegment(builder.BuildSegment());
+    CopyAttributes(memory_source, segments_.back());
+
+    terms_ = TermDictionary();
+    term_postings_.clear();
+    memory_inverse_document_freqs_ = InverseDocumentFreqCache();
+    dead_term_count_ = 0;
+    documents_ = DocumentColumns();
+    documents_.attributes = MakeAttributeColumns(0);
+    document_ordinals_.clear();
+    StartMergeIfNeeded();
+}
+
+void SearchServer::WaitForMerges() {
+    while (pending_merge_) {
+        InstallMerge();
+    }
+}
+
+void SearchServer::PublishSnapshot() {
+    Flush();
+    std::shared_ptr<SearchServer> snapshot(new SearchServer(stop_words_, segments_, GetDocumentIds()));
+    snapshot->attribute_names_ = attribute_names_;
+    snapshot->documents_.attributes = MakeAttributeColumns(0);
+    snapshot->SetMaxResultDocumentCount(max_result_document_count_);
+    snapshot->SetQueryCacheCapacity(synchronized_->query_cache.GetCapacity());
+    snapshot->SetThreadPool(thread_pool_);
+    snapshot->SetBatchParallelism(batch_parallelism_);
+    std::atomic_store(&snapshot_, std::shared_ptr<const SearchServer>(std::move(snapshot)));
+}
+
+std::shared_ptr<const SearchServer> SearchServer::GetSnapshot() const {
+    return std::atomic_load(&snapshot_);
+}
+
+// Appended documents get the next ordinals of the builder, so postings of each word stay
+// sorted as long as sources are appended in order.
+void SearchServer::AppendMemoryIndex(SegmentBuilder& builder) const {
+    const std::uint32_t no_ordinal = SegmentBuilder::no_ordinal;
+    std::vector<std::uint32_t> new_ordinals(documents_.ids.size(), no_ordinal);
+    for (const auto& [document_id, ordinal] : document_ordinals_) {
+        new_ordinals[ordinal] = 0;
+    }
+    for (std::uint32_t ordinal = 0; ordinal < new_ordinals.size(); ++ordinal) {
+        if (new_ordinals[ordinal] != no_ordinal) {
+            new_ordinals[ordinal] = builder.AddDocument(documents_.ids[ordinal], documents_.ratings[ordinal],
+                                                        documents_.statuses[ordinal],
+                                                        documents_.inv_word_counts[ordinal]);
+        }
+    }
+    for (TermId term_id = 0; term_id < terms_.size(); ++term_id) {
+        builder.AddPostings(terms_.GetWord(term_id), term_postings_[term_id].postings.GetView(), new_ordinals);
+    }
+}
+
+void SearchServer::AppendSegment(SegmentBuilder& builder, const SegmentState& state) {
+    const IndexSegment& segment = *state.segment;
+    std::vector<std::uint32_t> new_ordinals(segment.GetDocumentCount(), SegmentBuilder::no_ordinal);
+    for (std::uint32_t ordinal = 0; ordinal < new_ordinals.size(); ++ordinal) {
+        if (!state.is_removed[ordinal]) {
+            new_ordinals[ordinal] = builder.AddDocument(segment.GetDocumentIds()[ordinal],
+                                                        segment.GetRatings()[ordinal],
+                                                        segment.GetStatuses()[ordinal],
+                                                        segment.GetInvWordCounts()[ordinal]);
+        }
+    }
+    for (TermId term_id = 0; term_id < segment.GetTermCount(); ++term_id) {
+        builder.AddPostings(segment.GetWord(term_id), segment.GetPostings(term_id), new_ordinals);
+    }
+}
+
+// Tiered policy: a tier spans a merge_factor-fold range of live document counts, and
+// merge_factor segments of one tier are merged into one. A segment whose documents are
+// mostly removed is rewritten alone. At most one merge runs at a time.
+void SearchServer::StartMergeIfNeeded() {
+    if (pending_merge_) {
+        return;
+    }
+    const std::size_t merge_factor = 4;
+    std::map<std::size_t, std::vector<std::size_t>> tiers;
+    std::vector<std::size_t> selected;
+    for (std::size_t i = 0; i < segments_.size() && selected.empty(); ++i) {
+        const SegmentState& state = segments_[i];
+        const std::size_t document_count = state.segment->GetDocumentCount();
+        if (state.removed_count * 2 > document_count) {
+            selected = {i};
+            break;
+        }
+        std::size_t tier = 0;
+        for (std::size_t size = document_count - state.removed_count; size >= merge_factor; size /= merge_factor) {
+            ++tier;
+        }
+        std::vector<std::size_t>& tier_segments = tiers[tier];
+        tier_segments.push_back(i);
+        if (tier_segments.size() == merge_factor) {
+            selected = tier_segments;
+        }
+    }
+    if (selected.empty()) {
+        return;
+    }
+
+    PendingMerge merge;
+    for (std::size_t i : selected) {
+        merge.inputs.push_back(segments_[i]);
+    }
+    merge.result = std::async(std::launch::async,
+                              [inputs = merge.inputs,
+                               stop_words = std::vector<std::string>(stop_words_.begin(), stop_words_.end())]() {
+                                  SegmentBuilder builder;
+                                  builder.SetStopWords(stop_words);
+                                  for (const SegmentState& input : inputs) {
+                                      AppendSegment(builder, input);
+                                  }
+                                  return builder.BuildSegment();
+                              });
+    pending_merge_ = std::move(merge);
+}
+
+void SearchServer::InstallMergeIfReady() {
+    if (pending_merge_ && pending_merge_->result.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        InstallMerge();
+    }
+}
+
+// Replaces the merge inputs with the merged segment at the position of the first input and
+// replays removals made while the merge was running.
+void SearchServer::InstallMerge() {
+    PendingMerge merge = std::move(*pending_merge_);
+    pending_merge_.reset();
+    std::shared_ptr<const IndexSegment> segment = merge.result.get();
+
+    SegmentState merged;
+    merged.is_removed.assign(segment->GetDocumentCount(), false);
+    merged.removed_term_counts.assign(segment->GetTermCount(), 0);
+    merged.inverse_document_freqs.Resize(segment->GetTermCount());
+    merged.status_counts = CountStatuses(*segment);
+    merged.attributes = MakeAttributeColumns(segment->GetDocumentCount());
+    merged.segment = segment;
+    std::size_t position = segments_.size();
+    for (const SegmentState& input : merge.inputs) {
+        const auto it = std::find_if(segments_.begin(), segments_.end(), [&input](const SegmentState& state) {
+            return state.segment == input.segment;
+        });
+        position = std::min<std::size_t>(position, it - segments_.begin());
+        CopyAttributes(GetSource(it - segments_.begin()), merged);
+        const int* ids = input.segment->GetDocumentIds();
+        for (std::uint32_t ordinal = 0; ordinal < it->is_removed.size(); ++ordinal) {
+            if (it->is_removed[ordinal] && !input.is_removed[ordinal]) {
+                MarkRemoved(merged, *segment->FindOrdinal(ids[ordinal]));
+            }
+        }
+    }
+    segments_.erase(std::remove_if(segments_.begin(), segments_.end(), [&merge](const SegmentState& state) {
+        return std::any_of(merge.inputs.begin(), merge.inputs.end(), [&state](const SegmentState& input) {
+            return input.segment == state.segment;
+        });
+    }), segments_.end());
+    if (segment->GetDocumentCount() > 0) {
+        segments_.insert(segments_.begin() + position, std::move(merged));
+    }
+    StartMergeIfNeeded();
+}
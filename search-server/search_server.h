@@ -1,22 +1,37 @@
 #pragma once
 #include "document.h"
 #include "string_processing.h"
-#include "concurrent_map.h"
+#include "term_dictionary.h"
+#include "top_documents.h"
+#include "score_accumulator.h"
+#include "posting_list.h"
+#include "index_segment.h"
+#include "inverse_document_freq_cache.h"
+#include "query_result_cache.h"
+#include "thread_pool.h"
 
 #include <algorithm>
+#include <array>
 #include <cmath>
+#include <cstdint>
 #include <numeric>
 #include <map>
+#include <unordered_map>
 #include <set>
 #include <string>
 #include <string_view>
 #include <utility>
 #include <vector>
-#include <deque>
 #include <stdexcept>
 #include <iterator>
+#include <limits>
+#include <type_traits>
 #include <execution>
 #include <thread>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <future>
 
 using namespace std::string_literals;
 using namespace std::literals;
@@ -30,8 +45,23 @@ public:
 
     explicit SearchServer(const std::string& stop_words_text);
 
+    // Serves the documents of a segment written by SaveSegment; more can be added on top.
+    explicit SearchServer(std::shared_ptr<const IndexSegment> segment);
+
     void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
 
+    // Indexes a batch as AddDocument would one by one; the parallel overload tokenizes and
+    // inverts on the pool, the one without a policy is sequential. Throws before indexing
+    // anything if some document is invalid.
+    void AddDocuments(const std::vector<NewDocument>& documents);
+    void AddDocuments(const std::execution::sequenced_policy&, const std::vector<NewDocument>& documents);
+    void AddDocuments(const std::execution::parallel_policy&, const std::vector<NewDocument>& documents);
+
+    // Overloads without a policy are sequential, which is the recommended default: MaxScore
+    // skips most postings of long lists once the best results are known. Parallel overloads
+    // score every posting, in ordinal ranges of at least 4096 postings spread over the pool,
+    // so they only pay off with idle cores, for queries whose posting lists hold many times
+    // that, when latency matters more than the CPU time spent.
     template <typename DocumentPredicate>
     std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate) const;
     template <typename ExecutionPolicy, typename DocumentPredicate>
@@ -43,6 +73,9 @@ public:
                                             std::string_view raw_query, DocumentStatus status) const;
     std::vector<Document> FindTopDocuments(const std::execution::parallel_policy&,
                                             std::string_view raw_query, DocumentStatus status) const;
+    // Same as the sequential overload; is_cache_hit tells whether the query cache answered.
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+                                           bool& is_cache_hit) const;
 
     std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
     std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy&,
@@ -50,11 +83,72 @@ public:
     std::vector<Document> FindTopDocuments(const std::execution::parallel_policy&,
                                             std::string_view raw_query) const;
 
-    int GetDocumentCount() const;
-
-    std::set<int>::const_iterator begin() const;
-    std::set<int>::const_iterator end() const;
+    // Answers every query as FindTopDocuments(query) would, from ACTUAL documents. Each
+    // distinct word of the batch is resolved once, and queries sharing their longest posting
+    // list are scored one after another while it is still cached. The query cache is neither
+    // read nor filled: it would take a shard lock and a copy of the results per query, and
+    // one large batch of distinct queries would evict those interactive traffic repeats.
+    // Throws before scoring if some query is invalid.
+    std::vector<std::vector<Document>> FindTopDocumentsBatch(const std::vector<std::string>& raw_queries) const;
+    std::vector<std::vector<Document>> FindTopDocumentsBatch(const std::execution::sequenced_policy&,
+                                                             const std::vector<std::string>& raw_queries) const;
+    std::vector<std::vector<Document>> FindTopDocumentsBatch(const std::execution::parallel_policy&,
+                                                             const std::vector<std::string>& raw_queries) const;
+    // Same, with every result written straight into one flat buffer.
+    BatchResults FindTopDocumentsBatchJoined(const std::vector<std::string>& raw_queries) const;
+    BatchResults FindTopDocumentsBatchJoined(const std::execution::sequenced_policy&,
+                                             const std::vector<std::string>& raw_queries) const;
+    BatchResults FindTopDocumentsBatchJoined(const std::execution::parallel_policy&,
+                                             const std::vector<std::string>& raw_queries) const;
+    // Same, on thread_pool instead of the server's pool.
+    std::vector<std::vector<Document>> FindTopDocumentsBatch(ThreadPool& thread_pool,
+                                                             const std::vector<std::string>& raw_queries) const;
+    BatchResults FindTopDocumentsBatchJoined(ThreadPool& thread_pool,
+                                             const std::vector<std::string>& raw_queries) const;
 
+    int GetDocumentCount() const;
+    bool HasDocument(int document_id) const;
+
+    void SetMaxResultDocumentCount(std::size_t max_count);
+    std::size_t GetMaxResultDocumentCount() const;
+
+    // Caches the results of up to capacity distinct queries filtered by status, the default
+    // ACTUAL filter included; 0, the default, disables caching. Queries are told apart by
+    // their distinct plus and minus words, and every added or removed document invalidates
+    // cached results.
+    void SetQueryCacheCapacity(std::size_t capacity);
+    // Cache lookups since the capacity was last set.
+    QueryCacheStats GetQueryCacheStats() const;
+
+    // Parallel overloads run on thread_pool, which may be shared with other servers, instead
+    // of ThreadPool::GetDefault(); a pool of fewer threads caps the CPU the server takes.
+    void SetThreadPool(std::shared_ptr<ThreadPool> thread_pool);
+
+    enum class BatchParallelism {
+        // Queries are spread over the threads and each is scored by one: best throughput.
+        INTER_QUERY,
+        // Queries are scored one after another, each split over all threads: lower latency
+        // for a few queries with long posting lists.
+        INTRA_QUERY,
+    };
+    // How parallel batches use the pool; INTER_QUERY by default.
+    void SetBatchParallelism(BatchParallelism parallelism);
+
+    // Ids of the documents in ascending order, read from one contiguous array. Adding or
+    // removing documents invalidates the iterators.
+    std::vector<int>::const_iterator begin() const;
+    std::vector<int>::const_iterator end() const;
+
+    // Adds an integer column to every document, 0 until set, and returns its index for
+    // SetAttribute, GetAttribute and AttributeRangePredicate. Throws if a column of that name
+    // exists. Attributes are kept in memory only: SaveSegment does not write them.
+    std::size_t AddAttributeColumn(std::string_view name);
+    std::optional<std::size_t> FindAttributeColumn(std::string_view name) const;
+    // Both throw std::out_of_range for an unknown document or column.
+    void SetAttribute(int document_id, std::size_t column, std::int64_t value);
+    std::int64_t GetAttribute(int document_id, std::size_t column) const;
+
+    // The reference stays valid until the document is removed.
     const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
 
     void RemoveDocument(int document_id);
@@ -68,26 +162,189 @@ public:
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::parallel_policy&,
                                                                             std::string_view raw_query, int document_id)  const;
 
+    // Same, with the matched words written into matched_words, whose capacity is reused.
+    // Parallel overloads split only queries with enough words to pay for it.
+    DocumentStatus MatchDocument(std::string_view raw_query, int document_id,
+                                 std::vector<std::string_view>& matched_words) const;
+    DocumentStatus MatchDocument(const std::execution::sequenced_policy&, std::string_view raw_query, int document_id,
+                                 std::vector<std::string_view>& matched_words) const;
+    DocumentStatus MatchDocument(const std::execution::parallel_policy&, std::string_view raw_query, int document_id,
+                                 std::vector<std::string_view>& matched_words) const;
+
+    // Matches the query against every document as MatchDocument would, looking its words up
+    // once. Throws before matching anything if the query or some document id is invalid.
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(
+            std::string_view raw_query, const std::vector<int>& document_ids) const;
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(
+            const std::execution::sequenced_policy&, std::string_view raw_query,
+            const std::vector<int>& document_ids) const;
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocuments(
+            const std::execution::parallel_policy&, std::string_view raw_query,
+            const std::vector<int>& document_ids) const;
+
+    // Writes every document of the server into one segment file for IndexSegment::Open.
+    void SaveSegment(const std::string& path) const;
+
+    // New documents are indexed in memory and frozen into an immutable segment once
+    // document_count of them accumulate; 0 disables automatic flushing. Segments are merged
+    // in the background.
+    void SetFlushThreshold(std::size_t document_count);
+    void Flush();
+    // Waits for the running background merge, if any, and installs its result.
+    void WaitForMerges();
+
+    // Flushes pending changes and publishes the resulting state for GetSnapshot. Snapshots
+    // share segments with the server and never change, so they can be queried from any
+    // thread while the server keeps indexing. Each publish freezes the documents added since
+    // the last flush into a segment of their own, however few, and background merges then
+    // rewrite them into larger ones, so publish after batches of changes rather than each.
+    void PublishSnapshot();
+    // The last published snapshot, or nullptr before the first PublishSnapshot. Safe to call
+    // concurrently with modifications of the server.
+    std::shared_ptr<const SearchServer> GetSnapshot() const;
+
+    // For collections split over several servers, as ShardedSearchServer does: summing the
+    // document frequencies of every part gives the inverse document frequencies each part
+    // scores with, so results match one server holding every document.
+    // Live documents with each distinct plus word of raw_query; keys view raw_query.
+    std::map<std::string_view, std::size_t> GetDocumentFreqs(std::string_view raw_query) const;
+    // Adds the documents of raw_query to top_documents, scored with the given inverse
+    // document frequencies of its plus words; words missing from them match nothing.
+    template <typename DocumentPredicate>
+    void ScoreDocuments(std::string_view raw_query, const std::map<std::string_view, double>& inverse_document_freqs,
+                        DocumentPredicate document_predicate, TopDocuments& top_documents) const;
+
 private:
-    struct DocumentData {
-        int rating;
-        DocumentStatus status;
+    // Documents per DocumentStatus value, removed ones included.
+    using StatusCounts = std::array<std::size_t, 4>;
+
+    // Values of one custom attribute, indexed by ordinal. The bounds cover every value and
+    // only widen until the column is rebuilt, so a range missing them rules out the source.
+    struct AttributeColumn {
+        std::vector<std::int64_t> values;
+        std::int64_t min_value = 0;
+        std::int64_t max_value = 0;
+    };
+
+    // Documents are numbered densely in insertion order; postings refer to these ordinals.
+    struct TermPostings {
+        PostingList postings;
+        // Upper bound of term frequency, so max_term_freq * IDF bounds the term's score.
+        double max_term_freq = 0.0;
+        // Postings of removed documents, subtracted from the document frequency.
+        std::uint32_t removed_count = 0;
+    };
+    // Attributes of in-memory documents, indexed by ordinal. Removed documents keep their
+    // slots and postings until the next purge.
+    struct DocumentColumns {
+        std::vector<int> ids;
+        std::vector<int> ratings;
+        std::vector<DocumentStatus> statuses;
+        // Term frequency of a posting is its term_count times this.
+        std::vector<double> inv_word_counts;
+        std::vector<bool> is_removed;
+        std::size_t removed_count = 0;
+        StatusCounts status_counts = {};
+        // Forward index: the distinct terms of ordinal are term_ids[term_offsets[ordinal]] up
+        // to term_ids[term_offsets[ordinal + 1]], in ascending order.
+        std::vector<TermId> term_ids;
+        std::vector<std::size_t> term_offsets = std::vector<std::size_t>(1, 0);
+        // One per AddAttributeColumn.
+        std::vector<AttributeColumn> attributes;
+    };
+    // Segment postings are immutable, so removed documents are only marked.
+    struct SegmentState {
+        std::shared_ptr<const IndexSegment> segment;
+        std::vector<bool> is_removed;
+        std::size_t removed_count = 0;
+        // Postings of removed documents per term id, subtracted from document frequencies.
+        std::vector<std::uint32_t> removed_term_counts;
+        InverseDocumentFreqCache inverse_document_freqs;
+        StatusCounts status_counts = {};
+        // Segments store no custom attributes, so they are kept beside them.
+        std::vector<AttributeColumn> attributes;
+    };
+    // Inputs are captured when the merge starts; later removals are replayed on the result.
+    struct PendingMerge {
+        std::vector<SegmentState> inputs;
+        std::future<std::shared_ptr<const IndexSegment>> result;
     };
     const std::set<std::string, std::less<>> stop_words_;
-    std::deque<std::string> buffer_;
-    std::map<std::string_view, std::map<int, double>> word_to_document_freqs_;
-    std::map<int, std::map<std::string_view, double>> freqs_of_document_words_;
-    std::map<int, DocumentData> documents_;
-    std::set<int> document_ids_;
+    TermDictionary terms_;
+    std::vector<TermPostings> term_postings_;
+    // Terms whose postings all belong to removed documents.
+    std::size_t dead_term_count_ = 0;
+    InverseDocumentFreqCache memory_inverse_document_freqs_;
+    DocumentColumns documents_;
+    std::map<int, std::uint32_t> document_ordinals_;
+    std::vector<SegmentState> segments_;
+    std::optional<PendingMerge> pending_merge_;
+    std::size_t flush_threshold_ = 1 << 16;
+    // Read and written with std::atomic_load and std::atomic_store only.
+    std::shared_ptr<const SearchServer> snapshot_;
+    // Ids of live documents in ascending order. Ids added or removed since are collected
+    // unsorted and merged in by GetDocumentIds, so changes cost no more than an append.
+    mutable std::vector<int> document_ids_;
+    mutable std::vector<int> added_document_ids_;
+    mutable std::vector<int> removed_document_ids_;
+    std::size_t document_count_ = 0;
+    std::vector<std::string> attribute_names_;
+    // Advanced by every added or removed document.
+    std::uint64_t generation_ = 1;
+    std::size_t max_result_document_count_ = 5;
+    // State const methods change under locks, owned through a pointer so the server stays
+    // movable.
+    struct SynchronizedState {
+        std::mutex document_ids_mutex;
+        // Word frequencies are built on first request and kept until their document is
+        // removed. Their keys view word_freqs_words, which flushes and merges leave alone,
+        // where each word is counted by the maps using it and dropped with the last one.
+        std::mutex word_freqs_mutex;
+        std::map<int, std::map<std::string_view, double>> freqs_of_document_words;
+        std::map<std::string, std::size_t, std::less<>> word_freqs_words;
+        QueryResultCache query_cache;
+    };
+    std::unique_ptr<SynchronizedState> synchronized_ = std::make_unique<SynchronizedState>();
+    // nullptr for ThreadPool::GetDefault().
+    std::shared_ptr<ThreadPool> thread_pool_;
+    BatchParallelism batch_parallelism_ = BatchParallelism::INTER_QUERY;
+
 
     bool IsStopWord(std::string_view word) const;
 
     static bool IsValidWord(std::string_view word);
+    // The first word of text with a control character, for error messages.
+    static std::string_view FindInvalidWord(std::string_view text);
 
     std::vector<std::string_view> SplitIntoWordsNoStop(std::string_view text) const;
 
     static int ComputeAverageRating(const std::vector<int>& ratings);
 
+    // Merges the pending changes into document_ids_ and returns it.
+    const std::vector<int>& GetDocumentIds() const;
+    void AddDocumentId(int document_id);
+    void RemoveDocumentId(int document_id);
+    void MergeDocumentIdsIfNeeded();
+
+    // Execution policy of the overloads taking a pool.
+    struct ThreadPoolPolicy {
+        ThreadPool* thread_pool;
+    };
+
+    // The pool running parallel work under a policy, or nullptr to run it on the calling thread.
+    ThreadPool* GetExecutor(const std::execution::sequenced_policy&) const;
+    ThreadPool* GetExecutor(const std::execution::parallel_policy&) const;
+    static ThreadPool* GetExecutor(const ThreadPoolPolicy& policy);
+
+    // Runs task(i) for every i in [0, count) on executor, or in order without one.
+    template <typename Task>
+    static void ForEachIndex(ThreadPool* executor, std::size_t count, Task task);
+
+    template <typename ExecutionPolicy>
+    void AddDocumentBatch(const ExecutionPolicy& policy, const std::vector<NewDocument>& documents);
+    template <typename ExecutionPolicy>
+    void IndexDocuments(const ExecutionPolicy& policy, const NewDocument* first, const NewDocument* last);
+
     struct QueryWord {
         std::string_view data;
         bool is_minus;
@@ -101,10 +358,165 @@ private:
         std::vector<std::string_view> minus_words;
     };
 
-    Query ParseQuery(std::string_view text, bool remove_duplicates = false) const;
+    // Fills query, reusing its buffers.
+    void ParseQuery(std::string_view text, Query& query, bool remove_duplicates = false) const;
+
+    // Query buffers of the calling thread, so parsing stops allocating once they have grown.
+    // Only for queries that are done with them before running parallel algorithms, whose
+    // waiting threads may pick up other queries.
+    static Query& GetThreadQuery();
+
+    // Sets *is_cache_hit unless it is nullptr.
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocumentsByStatus(const ExecutionPolicy& policy, std::string_view raw_query,
+                                                   DocumentStatus status, bool* is_cache_hit) const;
+
+    // Keys a deduplicated query together with everything else its results depend on.
+    void MakeQueryCacheKey(const Query& query, DocumentStatus status, std::string& key) const;
+
+    // Read access to the documents of one index source: a segment or the in-memory index.
+    // Sources are numbered with the segments first and the in-memory index last.
+    struct SourceView {
+        const int* ids;
+        const int* ratings;
+        const DocumentStatus* statuses;
+        const double* inv_word_counts;
+        std::uint32_t ordinal_count;
+        // Removed documents whose postings have not been purged yet.
+        const std::vector<bool>* is_removed;
+        const StatusCounts* status_counts;
+        const std::vector<AttributeColumn>* attributes;
+    };
+
+    struct TermMatch {
+        TermId term_id;
+        PostingListView postings;
+        double max_term_freq;
+        // Postings of documents that have not been removed.
+        std::size_t document_freq;
+    };
+
+    struct WordPostings {
+        PostingListView postings;
+        double inverse_document_freq;
+        double max_score;
+    };
+
+    struct SourceQuery {
+        SourceView source;
+        std::vector<WordPostings> plus_words;
+        std::vector<PostingListView> minus_words;
+    };
+
+    struct DocumentLocation {
+        std::size_t source_index;
+        std::uint32_t ordinal;
+    };
+
+    SearchServer(const std::set<std::string, std::less<>>& stop_words, std::vector<SegmentState> segments,
+                 std::vector<int> document_ids);
+
+    void AttachSegment(std::shared_ptr<const IndexSegment> segment);
+    static StatusCounts CountStatuses(const IndexSegment& segment);
+
+    // Zeroed columns for ordinal_count documents, one per AddAttributeColumn.
+    std::vector<AttributeColumn> MakeAttributeColumns(std::size_t ordinal_count) const;
+    // Pads columns with zeros up to ordinal_count.
+    static void GrowAttributes(std::vector<AttributeColumn>& columns, std::size_t ordinal_count);
+    static void ComputeBounds(AttributeColumn& column);
+    // Copies the attributes of the live documents of source to their ordinals in the segment
+    // of state.
+    static void CopyAttributes(const SourceView& source, SegmentState& state);
+
+    std::size_t GetSourceCount() const;
+    SourceView GetSource(std::size_t source_index) const;
 
-    double ComputeWordInverseDocumentFreq(std::string_view word) const;
+    static bool IsRemoved(const SourceView& source, std::uint32_t ordinal);
 
+    // Throws std::out_of_range if the predicate refers to an unknown attribute column.
+    template <typename DocumentPredicate>
+    void CheckPredicate(const DocumentPredicate& document_predicate) const;
+
+    // StatusPredicate, AcceptAllPredicate and AttributeRangePredicate are checked before
+    // scoring, and without loading ids and ratings.
+    template <typename DocumentPredicate>
+    static constexpr bool IsKnownPredicate();
+    template <typename DocumentPredicate>
+    static bool IsAccepted(const SourceView& source, std::uint32_t ordinal, DocumentPredicate& document_predicate);
+    // False if no document of source can pass, so the source is not scored at all.
+    template <typename DocumentPredicate>
+    static bool MayAccept(const SourceView& source, const DocumentPredicate& document_predicate);
+
+    static double ComputeTermFreq(const SourceView& source, const Posting& posting);
+
+    std::optional<DocumentLocation> FindDocument(int document_id) const;
+
+    bool HasWord(const DocumentLocation& location, std::string_view word) const;
+    // Binary search in the forward index of the document's source.
+    bool HasTerm(const DocumentLocation& location, TermId term_id) const;
+    // Distinct terms of the document.
+    std::size_t GetTermCount(const DocumentLocation& location) const;
+
+    // Fills matched_words with the plus words of the query the document has, or leaves it
+    // empty if it has a minus word; splits long queries over executor.
+    DocumentStatus MatchDocumentWords(ThreadPool* executor, std::string_view raw_query, int document_id,
+                                      std::vector<std::string_view>& matched_words) const;
+
+    template <typename ExecutionPolicy>
+    std::vector<std::tuple<std::vector<std::string_view>, DocumentStatus>> MatchDocumentsInBatch(
+            const ExecutionPolicy& policy, std::string_view raw_query, const std::vector<int>& document_ids) const;
+
+    void RemoveSegmentDocument(int document_id);
+    void EraseWordFrequencies(int document_id);
+    static void MarkRemoved(SegmentState& state, std::uint32_t ordinal);
+
+    void AppendMemoryIndex(SegmentBuilder& builder) const;
+    static void AppendSegment(SegmentBuilder& builder, const SegmentState& state);
+
+    void StartMergeIfNeeded();
+    void InstallMergeIfReady();
+    void InstallMerge();
+
+    std::optional<TermMatch> FindTerm(std::size_t source_index, std::string_view word) const;
+
+    const InverseDocumentFreqCache& GetInverseDocumentFreqs(std::size_t source_index) const;
+
+    void RemoveMemoryDocument(int document_id, std::uint32_t ordinal);
+    void PurgeRemovedDocumentsIfNeeded();
+
+    // Fills one SourceQuery per source.
+    void ResolveQuery(const Query& query, std::vector<SourceQuery>& source_queries) const;
+    // Same, with the inverse document frequency of each plus word given, nothing for words
+    // no document has.
+    void ResolveQuery(const Query& query, const std::vector<std::optional<double>>& inverse_document_freqs,
+                      std::vector<SourceQuery>& source_queries) const;
+
+    // Fills one match per source and returns the number of live documents with word.
+    std::size_t FindTermInSources(std::string_view word, std::optional<TermMatch>* matches) const;
+    std::size_t GetDocumentFreq(std::string_view word) const;
+
+    // Finds word in every source, filling one match per source, and returns its inverse
+    // document frequency, or nothing if no live document has it. Inverse document
+    // frequencies are global over sources and cached by the first source holding the term
+    // until the generation changes.
+    std::optional<double> ResolveTerm(std::string_view word, std::optional<TermMatch>* matches) const;
+
+    // Points source_queries at the current sources, without words.
+    void ResetSourceQueries(std::vector<SourceQuery>& source_queries) const;
+    static void AddPlusWord(const std::optional<TermMatch>* matches, double inverse_document_freq,
+                            std::vector<SourceQuery>& source_queries);
+    static void AddMinusWord(const std::optional<TermMatch>* matches, std::vector<SourceQuery>& source_queries);
+
+    // Calls write_results(query_index, top_documents) once per query, concurrently for
+    // distinct queries, unless no results are wanted at all.
+    template <typename ExecutionPolicy, typename ResultWriter>
+    void FindTopDocumentsInBatch(const ExecutionPolicy& policy, const std::vector<std::string>& raw_queries,
+                                 ResultWriter write_results) const;
+    template <typename ExecutionPolicy>
+    BatchResults FindJoinedTopDocumentsInBatch(const ExecutionPolicy& policy,
+                                               const std::vector<std::string>& raw_queries) const;
+
+    // Returns at most max_result_document_count_ best matches, best first.
     template <typename DocumentPredicate>
     std::vector<Document> FindAllDocuments(const Query& query, DocumentPredicate document_predicate) const;
     template <typename DocumentPredicate>
@@ -113,6 +525,25 @@ private:
     template <typename DocumentPredicate>
     std::vector<Document> FindAllDocuments(const std::execution::parallel_policy&,
                                             const Query& query, DocumentPredicate document_predicate) const;
+
+    static ScoreAccumulator& GetThreadAccumulator();
+
+    // Scores resolved sources one after another into top_documents.
+    template <typename DocumentPredicate>
+    void ScoreSourceQueries(const std::vector<SourceQuery>& source_queries,
+                            DocumentPredicate document_predicate, TopDocuments& top_documents) const;
+
+    // Scores resolved sources in ordinal ranges spread over executor, merging into top_documents.
+    template <typename DocumentPredicate>
+    void ScoreSourceQueriesInRanges(ThreadPool& executor, const std::vector<SourceQuery>& source_queries,
+                                    DocumentPredicate document_predicate, TopDocuments& top_documents) const;
+
+    template <typename DocumentPredicate>
+    void ScoreOrdinalRange(const SourceQuery& source_query, std::uint32_t first, std::uint32_t last,
+                           DocumentPredicate document_predicate, TopDocuments& top_documents) const;
+    template <typename DocumentPredicate>
+    void ScoreWithMaxScore(const SourceQuery& source_query, DocumentPredicate document_predicate,
+                           TopDocuments& top_documents) const;
 };
 
 template <typename StringContainer>
@@ -133,22 +564,110 @@ std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query,
 template <typename ExecutionPolicy, typename DocumentPredicate>
 std::vector<Document> SearchServer::FindTopDocuments(const ExecutionPolicy& policy,
                                                      std::string_view raw_query, DocumentPredicate document_predicate) const {
-    const auto query = ParseQuery(raw_query, true);
-    auto matched_documents = FindAllDocuments(policy, query, document_predicate);
+    Query& query = GetThreadQuery();
+    ParseQuery(raw_query, query, true);
+    CheckPredicate(document_predicate);
+    return FindAllDocuments(policy, query, document_predicate);
+}
 
-    const double epsilon = 1e-6;
-    std::sort(
-             policy,
-             matched_documents.begin(), matched_documents.end(),
-             [epsilon](const Document& lhs, const Document& rhs) {
-                 return lhs.relevance > rhs.relevance
-                     || (std::abs(lhs.relevance - rhs.relevance) < epsilon && lhs.rating > rhs.rating);
-             });
-    const int max_result_document_count = 5;
-    if (matched_documents.size() > max_result_document_count) {
-        matched_documents.resize(max_result_document_count);
+template <typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocumentsByStatus(const ExecutionPolicy& policy, std::string_view raw_query,
+                                                             DocumentStatus status, bool* is_cache_hit) const {
+    Query& query = GetThreadQuery();
+    ParseQuery(raw_query, query, true);
+    const StatusPredicate document_predicate{status};
+    if (is_cache_hit) {
+        *is_cache_hit = false;
+    }
+    if (synchronized_->query_cache.GetCapacity() == 0) {
+        return FindAllDocuments(policy, query, document_predicate);
+    }
+    static thread_local std::string key;
+    MakeQueryCacheKey(query, status, key);
+    if (auto documents = synchronized_->query_cache.Find(key, generation_)) {
+        if (is_cache_hit) {
+            *is_cache_hit = true;
+        }
+        return std::move(*documents);
+    }
+    // Copied before scoring, which may run other queries on this thread while it waits.
+    std::string inserted_key = key;
+    std::vector<Document> documents = FindAllDocuments(policy, query, document_predicate);
+    synchronized_->query_cache.Insert(std::move(inserted_key), generation_, documents);
+    return documents;
+}
+
+template <typename DocumentPredicate>
+void SearchServer::ScoreDocuments(std::string_view raw_query,
+                                  const std::map<std::string_view, double>& inverse_document_freqs,
+                                  DocumentPredicate document_predicate, TopDocuments& top_documents) const {
+    // Not the thread's buffers: callers run this as a task of a parallel loop.
+    Query query;
+    ParseQuery(raw_query, query, true);
+    CheckPredicate(document_predicate);
+    std::vector<std::optional<double>> query_inverse_document_freqs;
+    for (std::string_view word : query.plus_words) {
+        const auto it = inverse_document_freqs.find(word);
+        query_inverse_document_freqs.push_back(it == inverse_document_freqs.end() ? std::nullopt
+                                                                                   : std::optional(it->second));
+    }
+    std::vector<SourceQuery> source_queries;
+    ResolveQuery(query, query_inverse_document_freqs, source_queries);
+    ScoreSourceQueries(source_queries, document_predicate, top_documents);
+}
+
+template <typename DocumentPredicate>
+void SearchServer::CheckPredicate(const DocumentPredicate& document_predicate) const {
+    if constexpr (std::is_same_v<DocumentPredicate, AttributeRangePredicate>) {
+        if (document_predicate.column >= attribute_names_.size()) {
+            throw std::out_of_range("Invalid attribute column");
+        }
+    }
+}
+
+template <typename DocumentPredicate>
+constexpr bool SearchServer::IsKnownPredicate() {
+    return std::is_same_v<DocumentPredicate, StatusPredicate> || std::is_same_v<DocumentPredicate, AcceptAllPredicate>
+           || std::is_same_v<DocumentPredicate, AttributeRangePredicate>;
+}
+
+template <typename DocumentPredicate>
+bool SearchServer::IsAccepted(const SourceView& source, std::uint32_t ordinal, DocumentPredicate& document_predicate) {
+    if constexpr (std::is_same_v<DocumentPredicate, StatusPredicate>) {
+        return source.statuses[ordinal] == document_predicate.status;
+    } else if constexpr (std::is_same_v<DocumentPredicate, AcceptAllPredicate>) {
+        return true;
+    } else if constexpr (std::is_same_v<DocumentPredicate, AttributeRangePredicate>) {
+        const std::int64_t value = (*source.attributes)[document_predicate.column].values[ordinal];
+        return source.statuses[ordinal] == document_predicate.status
+               && value >= document_predicate.min_value && value <= document_predicate.max_value;
+    } else {
+        return document_predicate(source.ids[ordinal], source.statuses[ordinal], source.ratings[ordinal]);
+    }
+}
+
+template <typename DocumentPredicate>
+bool SearchServer::MayAccept(const SourceView& source, const DocumentPredicate& document_predicate) {
+    if constexpr (std::is_same_v<DocumentPredicate, StatusPredicate>) {
+        return (*source.status_counts)[static_cast<std::size_t>(document_predicate.status)] > 0;
+    } else if constexpr (std::is_same_v<DocumentPredicate, AttributeRangePredicate>) {
+        const AttributeColumn& column = (*source.attributes)[document_predicate.column];
+        return (*source.status_counts)[static_cast<std::size_t>(document_predicate.status)] > 0
+               && column.min_value <= document_predicate.max_value && column.max_value >= document_predicate.min_value;
+    } else {
+        return true;
+    }
+}
+
+template <typename Task>
+void SearchServer::ForEachIndex(ThreadPool* executor, std::size_t count, Task task) {
+    if (executor) {
+        executor->ParallelFor(count, task);
+        return;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        task(i);
     }
-    return matched_documents;
 }
 
 template <typename DocumentPredicate>
@@ -160,69 +679,241 @@ std::vector<Document> SearchServer::FindAllDocuments(const Query& query,
 template <typename DocumentPredicate>
 std::vector<Document> SearchServer::FindAllDocuments(const std::execution::sequenced_policy&,
                                                      const Query& query, DocumentPredicate document_predicate) const {
-    std::map<int, double> document_to_relevance;
-    for (const std::string_view& word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
+    if (max_result_document_count_ == 0) {
+        return {};
+    }
+    static thread_local std::vector<SourceQuery> source_queries;
+    ResolveQuery(query, source_queries);
+    TopDocuments top_documents(max_result_document_count_);
+    ScoreSourceQueries(source_queries, document_predicate, top_documents);
+    return top_documents.Release();
+}
+
+template <typename DocumentPredicate>
+void SearchServer::ScoreSourceQueries(const std::vector<SourceQuery>& source_queries,
+                                      DocumentPredicate document_predicate, TopDocuments& top_documents) const {
+    for (const SourceQuery& source_query : source_queries) {
+        if (MayAccept(source_query.source, document_predicate)) {
+            ScoreWithMaxScore(source_query, document_predicate, top_documents);
         }
-        const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-        for (const auto& [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-            const auto& document_data = documents_.at(document_id);
-            if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                document_to_relevance[document_id] += term_freq * inverse_document_freq;
+    }
+}
+
+// Term-at-a-time scoring of the postings in [first, last) into the calling thread's
+// dense accumulator. Minus words are applied first by excluding their ordinals.
+template <typename DocumentPredicate>
+void SearchServer::ScoreOrdinalRange(const SourceQuery& source_query, std::uint32_t first, std::uint32_t last,
+                                     DocumentPredicate document_predicate, TopDocuments& top_documents) const {
+    const SourceView& source = source_query.source;
+    ScoreAccumulator& accumulator = GetThreadAccumulator();
+    accumulator.Resize(source.ordinal_count);
+    for (const PostingListView& postings : source_query.minus_words) {
+        postings.ForEachInRange(first, last, [&accumulator](const Posting& posting) {
+            accumulator.Exclude(posting.ordinal);
+        });
+    }
+    for (const WordPostings& word : source_query.plus_words) {
+        word.postings.ForEachInRange(first, last, [&](const Posting& posting) {
+            accumulator.Add(posting.ordinal, ComputeTermFreq(source, posting) * word.inverse_document_freq);
+        });
+    }
+
+    accumulator.ForEachScored([&](std::uint32_t ordinal, double relevance) {
+        if (!IsRemoved(source, ordinal) && IsAccepted(source, ordinal, document_predicate)) {
+            top_documents.Add({source.ids[ordinal], relevance, source.ratings[ordinal]});
+        }
+    });
+    accumulator.Clear();
+}
+
+// Document-at-a-time MaxScore evaluation. Plus-word cursors are ordered by their score
+// upper bound; once the result heap is full, the weakest words whose bounds together cannot
+// beat the current worst result stop generating candidates and are only probed for
+// documents found through the stronger ones. Every candidate is compared against each
+// essential cursor, while exhaustive scoring touches each posting once, so whenever the
+// essential cursors times their postings outweigh all postings of the query, the rest of
+// the ordinals are scored exhaustively instead.
+template <typename DocumentPredicate>
+void SearchServer::ScoreWithMaxScore(const SourceQuery& source_query, DocumentPredicate document_predicate,
+                                     TopDocuments& top_documents) const {
+    struct WordCursor {
+        PostingListCursor cursor;
+        double inverse_document_freq;
+        double max_score;
+        std::size_t posting_count;
+    };
+    static thread_local std::vector<WordCursor> cursors;
+    static thread_local std::vector<PostingListCursor> minus_cursors;
+    static thread_local std::vector<double> cumulative_max_scores;
+    // Postings of the cursors from i on.
+    static thread_local std::vector<std::size_t> essential_posting_counts;
+    cursors.clear();
+    minus_cursors.clear();
+    cumulative_max_scores.clear();
+    essential_posting_counts.clear();
+
+    const SourceView& source = source_query.source;
+    for (const WordPostings& word : source_query.plus_words) {
+        cursors.push_back({PostingListCursor(word.postings), word.inverse_document_freq, word.max_score,
+                           word.postings.size()});
+    }
+    std::sort(cursors.begin(), cursors.end(),
+              [](const WordCursor& lhs, const WordCursor& rhs) { return lhs.max_score < rhs.max_score; });
+    double cumulative_max_score = 0.0;
+    for (const WordCursor& cursor : cursors) {
+        cumulative_max_score += cursor.max_score;
+        cumulative_max_scores.push_back(cumulative_max_score);
+    }
+    essential_posting_counts.assign(cursors.size() + 1, 0);
+    for (std::size_t i = cursors.size(); i-- > 0;) {
+        essential_posting_counts[i] = essential_posting_counts[i + 1] + cursors[i].posting_count;
+    }
+    // Cost of comparing a candidate against one cursor relative to scoring one posting
+    // exhaustively, and how often the costs are compared.
+    const double cursor_step_cost = 1.0;
+    const std::size_t cost_check_interval = 16;
+    std::size_t candidate_count = 0;
+
+    for (const PostingListView& postings : source_query.minus_words) {
+        minus_cursors.emplace_back(postings);
+    }
+    const auto is_excluded = [](std::uint32_t ordinal) {
+        for (PostingListCursor& cursor : minus_cursors) {
+            cursor.SkipTo(ordinal);
+            if (!cursor.IsEnd() && cursor->ordinal == ordinal) {
+                return true;
             }
         }
+        return false;
+    };
+
+    const double epsilon = 1e-6;
+    const std::uint32_t no_ordinal = std::numeric_limits<std::uint32_t>::max();
+    double threshold = -std::numeric_limits<double>::infinity();
+    std::size_t first_essential = 0;
+    const auto raise_threshold = [&]() {
+        threshold = top_documents.GetWorst().relevance;
+        while (first_essential < cursors.size()
+               && cumulative_max_scores[first_essential] < threshold - epsilon) {
+            ++first_essential;
+        }
+    };
+    if (top_documents.IsFull()) {
+        raise_threshold();
     }
-    for (const std::string_view& word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
+    while (first_essential < cursors.size()) {
+        std::uint32_t ordinal = no_ordinal;
+        for (std::size_t i = first_essential; i < cursors.size(); ++i) {
+            if (!cursors[i].cursor.IsEnd()) {
+                ordinal = std::min(ordinal, cursors[i].cursor->ordinal);
+            }
+        }
+        if (ordinal == no_ordinal) {
+            break;
+        }
+        if (++candidate_count % cost_check_interval == 0
+            && (cursors.size() - first_essential) * essential_posting_counts[first_essential] * cursor_step_cost
+               > essential_posting_counts[0]) {
+            ScoreOrdinalRange(source_query, ordinal, source.ordinal_count, document_predicate, top_documents);
+            return;
+        }
+        if (IsRemoved(source, ordinal)
+            || (IsKnownPredicate<DocumentPredicate>() && !IsAccepted(source, ordinal, document_predicate))) {
+            for (std::size_t i = first_essential; i < cursors.size(); ++i) {
+                PostingListCursor& cursor = cursors[i].cursor;
+                if (!cursor.IsEnd() && cursor->ordinal == ordinal) {
+                    cursor.Next();
+                }
+            }
             continue;
         }
-        for (const auto& [document_id, _] : word_to_document_freqs_.at(word)) {
-            document_to_relevance.erase(document_id);
+
+        double relevance = 0.0;
+        for (std::size_t i = first_essential; i < cursors.size(); ++i) {
+            PostingListCursor& cursor = cursors[i].cursor;
+            if (!cursor.IsEnd() && cursor->ordinal == ordinal) {
+                relevance += ComputeTermFreq(source, *cursor) * cursors[i].inverse_document_freq;
+                cursor.Next();
+            }
+        }
+        bool is_pruned = false;
+        for (std::size_t i = first_essential; i-- > 0;) {
+            if (relevance + cumulative_max_scores[i] < threshold - epsilon) {
+                is_pruned = true;
+                break;
+            }
+            PostingListCursor& cursor = cursors[i].cursor;
+            cursor.SkipTo(ordinal);
+            if (!cursor.IsEnd() && cursor->ordinal == ordinal) {
+                relevance += ComputeTermFreq(source, *cursor) * cursors[i].inverse_document_freq;
+            }
+        }
+        if (is_pruned || relevance < threshold - epsilon || is_excluded(ordinal)) {
+            continue;
+        }
+        if (!IsKnownPredicate<DocumentPredicate>() && !IsAccepted(source, ordinal, document_predicate)) {
+            continue;
         }
-    }
 
-    std::vector<Document> matched_documents;
-    for (const auto& [document_id, relevance] : document_to_relevance) {
-        matched_documents.push_back(
-            {document_id, relevance, documents_.at(document_id).rating});
+        top_documents.Add({source.ids[ordinal], relevance, source.ratings[ordinal]});
+        if (top_documents.IsFull()) {
+            raise_threshold();
+        }
     }
-    return matched_documents;
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const std::execution::parallel_policy&,
+std::vector<Document> SearchServer::FindAllDocuments(const std::execution::parallel_policy& policy,
                                                      const Query& query, DocumentPredicate document_predicate) const {
-    ConcurrentMap<int, double> document_to_relevance(std::thread::hardware_concurrency());
-    std::for_each(
-                  std::execution::par,
-                  query.plus_words.begin(), query.plus_words.end(),
-                  [&](std::string_view word) {
-                    if (word_to_document_freqs_.count(word) != 0) {
-                        const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-                        for (const auto& [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-                            const auto& document_data = documents_.at(document_id);
-                            if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                                document_to_relevance[document_id].ref_to_value += term_freq * inverse_document_freq;
-                            }
-                        }
-                    }
-                });
-    std::for_each(
-                  std::execution::par,
-                  query.minus_words.begin(), query.minus_words.end(),
-                  [&](std::string_view word) {
-                    if (word_to_document_freqs_.count(word) != 0) {
-                        for (const auto& [document_id, _] : word_to_document_freqs_.at(word)) {
-                            document_to_relevance.BuildOrdinaryMap().erase(document_id);
-                        }
-                    }
-                });
-
-    std::vector<Document> matched_documents;
-    for (const auto& [document_id, relevance] : document_to_relevance.BuildOrdinaryMap()) {
-        matched_documents.push_back(
-            {document_id, relevance, documents_.at(document_id).rating});
-    }
-    return matched_documents;
-}
\ No newline at end of file
+    if (max_result_document_count_ == 0) {
+        return {};
+    }
+    // Not thread-local: range tasks read it from other threads.
+    std::vector<SourceQuery> source_queries;
+    ResolveQuery(query, source_queries);
+    TopDocuments top_documents(max_result_document_count_);
+    ScoreSourceQueriesInRanges(*GetExecutor(policy), source_queries, document_predicate, top_documents);
+    return top_documents.Release();
+}
+
+// Splits the ordinal space of every source into ranges scored independently, each into the
+// accumulator of the thread that runs it, so no posting needs a lock. Per-range heaps are
+// merged at the end.
+template <typename DocumentPredicate>
+void SearchServer::ScoreSourceQueriesInRanges(ThreadPool& executor, const std::vector<SourceQuery>& source_queries,
+                                              DocumentPredicate document_predicate,
+                                              TopDocuments& top_documents) const {
+    struct OrdinalRange {
+        const SourceQuery* source_query;
+        std::uint32_t first;
+        std::uint32_t last;
+    };
+    const std::size_t min_postings_per_range = 4096;
+    const std::size_t max_range_count = executor.GetConcurrency();
+    std::vector<OrdinalRange> ranges;
+    for (const SourceQuery& source_query : source_queries) {
+        if (!MayAccept(source_query.source, document_predicate)) {
+            continue;
+        }
+        std::size_t posting_count = 0;
+        for (const WordPostings& word : source_query.plus_words) {
+            posting_count += word.postings.size();
+        }
+        const std::size_t range_count = std::clamp<std::size_t>(posting_count / min_postings_per_range,
+                                                                1, max_range_count);
+        const std::size_t ordinal_count = source_query.source.ordinal_count;
+        for (std::size_t range = 0; range < range_count; ++range) {
+            ranges.push_back({&source_query, static_cast<std::uint32_t>(ordinal_count * range / range_count),
+                              static_cast<std::uint32_t>(ordinal_count * (range + 1) / range_count)});
+        }
+    }
+
+    std::vector<TopDocuments> range_tops(ranges.size(), TopDocuments(max_result_document_count_));
+    executor.ParallelFor(ranges.size(), [&](std::size_t index) {
+        const OrdinalRange& range = ranges[index];
+        ScoreOrdinalRange(*range.source_query, range.first, range.last, document_predicate, range_tops[index]);
+    });
+    for (const TopDocuments& range_top : range_tops) {
+        top_documents.Merge(range_top);
+    }
+}
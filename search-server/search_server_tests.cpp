@@ -0,0 +1,1682 @@
+#include "index_segment.h"
+#include "posting_list.h"
+#include "process_queries.h"
+#include "request_queue.h"
+#include "search_server.h"
+#include "sharded_search_server.h"
+#include "simd.h"
+#include "term_dictionary.h"
+#include "thread_pool.h"
+#include "top_documents.h"
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <execution>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+int failure_count = 0;
+
+void Assert(bool value, const string& expr_str, const string& file, unsigned line, const string& hint) {
+    if (!value) {
+        ++failure_count;
+        cerr << file << "("s << line << "): ASSERT("s << expr_str << ") failed."s;
+        if (!hint.empty()) {
+            cerr << " Hint: "s << hint;
+        }
+        cerr << endl;
+    }
+}
+
+#define ASSERT(expr) Assert(!!(expr), #expr, __FILE__, __LINE__, ""s)
+#define ASSERT_HINT(expr, hint) Assert(!!(expr), #expr, __FILE__, __LINE__, (hint))
+
+vector<int> GetIds(const vector<Document>& documents) {
+    vector<int> ids;
+    for (const Document& document : documents) {
+        ids.push_back(document.id);
+    }
+    return ids;
+}
+
+// Same documents in the same order, with relevances equal up to rounding.
+bool AreSameDocuments(const vector<Document>& lhs, const vector<Document>& rhs) {
+    if (lhs.size() != rhs.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < lhs.size(); ++i) {
+        if (lhs[i].id != rhs[i].id || lhs[i].rating != rhs[i].rating
+            || abs(lhs[i].relevance - rhs[i].relevance) >= 1e-9) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Splits on single spaces and drops empty words, byte by byte.
+vector<string_view> SplitIntoWordsNaively(string_view text) {
+    vector<string_view> words;
+    size_t word_begin = 0;
+    for (size_t i = 0; i <= text.size(); ++i) {
+        if (i == text.size() || text[i] == ' ') {
+            if (i > word_begin) {
+                words.push_back(text.substr(word_begin, i - word_begin));
+            }
+            word_begin = i + 1;
+        }
+    }
+    return words;
+}
+
+// Every scanning implementation splits texts as a byte-by-byte loop does and finds control
+// characters anywhere: words crossing 64-byte blocks, tails shorter than a block, runs of
+// spaces, leading and trailing spaces, and bytes above 127, which are not control characters.
+void TestTokenizerMatchesNaiveSplit() {
+    const vector<string> fixed_texts = {
+        ""s, " "s, "   "s, "a"s, " a "s, "  leading"s, "trailing   "s, "runs    of     spaces"s,
+        string(63, 'x') + " y"s, string(64, 'x') + " y"s, string(65, 'x'), string(62, ' ') + "crossing block"s,
+        string(64, ' ') + "a"s, string(127, 'z') + " "s + string(70, 'q'), "caf\xc3\xa9 na\xefve"s,
+        "tab\tseparated"s, string(100, 'a') + "\x1f"s, "\x01"s, string(64, 'b') + "\n"s + string(10, 'c'),
+    };
+    mt19937 generator(20240801);
+    vector<string> texts = fixed_texts;
+    for (int i = 0; i < 2000; ++i) {
+        string text(uniform_int_distribution<int>(0, 300)(generator), ' ');
+        const bool has_control_chars = i % 4 == 0;
+        for (char& c : text) {
+            const int kind = uniform_int_distribution<int>(0, 99)(generator);
+            if (kind < 30) {
+                c = ' ';
+            } else if (kind < 95 || !has_control_chars) {
+                c = static_cast<char>(uniform_int_distribution<int>(33, 255)(generator));
+            } else {
+                c = static_cast<char>(uniform_int_distribution<int>(0, 31)(generator));
+            }
+        }
+        texts.push_back(move(text));
+    }
+
+    const vector<pair<SimdLevel, string>> levels = {
+        {SimdLevel::SCALAR, "scalar"s}, {SimdLevel::SSE2, "SSE2"s}, {SimdLevel::AVX2, "AVX2"s}};
+    for (const auto& [level, level_name] : levels) {
+        SetMaxSimdLevel(level);
+        const int failure_count_before = failure_count;
+        for (const string& text : texts) {
+            const bool has_control_chars = any_of(text.begin(), text.end(), [](char c) {
+                return static_cast<unsigned char>(c) < ' ';
+            });
+            const vector<string_view> expected = SplitIntoWordsNaively(text);
+            vector<string_view> visited;
+            const bool is_clean = ForEachWord(text, [&visited](string_view word) { visited.push_back(word); });
+            ASSERT_HINT(visited == expected && is_clean == !has_control_chars, level_name);
+            ASSERT_HINT(SplitIntoWords(text) == expected, level_name);
+            ASSERT_HINT(HasControlChars(text) == has_control_chars, level_name);
+            if (failure_count > failure_count_before) {
+                break;
+            }
+        }
+
+        SearchServer search_server(""s);
+        bool is_rejected = false;
+        try {
+            search_server.AddDocument(1, string(70, 'w') + "\x02"s, DocumentStatus::ACTUAL, {1});
+        } catch (const invalid_argument&) {
+            is_rejected = true;
+        }
+        ASSERT_HINT(is_rejected && search_server.GetDocumentCount() == 0, level_name);
+        is_rejected = false;
+        try {
+            search_server.FindTopDocuments("cat dog \x10"s);
+        } catch (const invalid_argument&) {
+            is_rejected = true;
+        }
+        ASSERT_HINT(is_rejected, level_name);
+    }
+    SetMaxSimdLevel(SimdLevel::AVX2);
+}
+
+// Words get dense ids in first-seen order, and the views the dictionary returns stay valid
+// while it grows, for words longer than one storage chunk too.
+void TestTermDictionaryInternsWords() {
+    TermDictionary terms;
+    ASSERT(terms.size() == 0 && !terms.Find("cat"sv));
+    const string long_word(100000, 'x');
+    vector<string> words;
+    for (int i = 0; i < 5000; ++i) {
+        words.push_back("word"s + to_string(i));
+    }
+    words.push_back(long_word);
+    vector<string_view> stored;
+    for (TermId term_id = 0; term_id < words.size(); ++term_id) {
+        ASSERT(terms.Intern(words[term_id]) == term_id);
+        stored.push_back(terms.GetWord(term_id));
+    }
+    ASSERT(terms.size() == words.size());
+    for (TermId term_id = 0; term_id < words.size(); ++term_id) {
+        ASSERT_HINT(terms.Intern(words[term_id]) == term_id && terms.Find(words[term_id]) == term_id,
+                    words[term_id].substr(0, 10));
+        ASSERT(stored[term_id] == words[term_id] && stored[term_id].data() == terms.GetWord(term_id).data());
+    }
+    ASSERT(terms.size() == words.size());
+    ASSERT(!terms.Find("word5000"sv) && !terms.Find(""sv));
+}
+
+vector<Posting> MakeTestPostings(mt19937& generator, size_t count) {
+    // Gaps and term counts of every encoded length, from one byte to four.
+    const vector<uint32_t> limits = {1, 255, 256, 65536, 1 << 24, 1 << 25};
+    vector<Posting> postings;
+    uint32_t ordinal = uniform_int_distribution<uint32_t>(0, 300)(generator);
+    for (size_t i = 0; i < count; ++i) {
+        const uint32_t gap_limit = limits[uniform_int_distribution<size_t>(0, limits.size() - 2)(generator)];
+        const uint32_t count_limit = limits[uniform_int_distribution<size_t>(0, limits.size() - 1)(generator)];
+        postings.push_back({ordinal, uniform_int_distribution<uint32_t>(1, count_limit)(generator)});
+        ordinal += uniform_int_distribution<uint32_t>(1, gap_limit)(generator);
+    }
+    return postings;
+}
+
+bool IsSamePosting(const Posting& lhs, const Posting& rhs) {
+    return lhs.ordinal == rhs.ordinal && lhs.term_count == rhs.term_count;
+}
+
+bool AreSamePostings(const vector<Posting>& lhs, const vector<Posting>& rhs) {
+    return equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), IsSamePosting);
+}
+
+// Lists of every length around the block size decode to what was appended, with the newest
+// postings in the tail or sealed into a short block, under every decoder the CPU runs.
+void TestPostingListRoundTrip() {
+    mt19937 generator(7);
+    for (SimdLevel level : {SimdLevel::SCALAR, SimdLevel::AVX2}) {
+        SetMaxSimdLevel(level);
+        for (size_t count : {0, 1, 2, 7, 8, 9, 127, 128, 129, 256, 1000}) {
+            const vector<Posting> expected = MakeTestPostings(generator, count);
+            PostingList list;
+            for (const Posting& posting : expected) {
+                list.Append(posting);
+            }
+            for (bool is_sealed : {false, true}) {
+                if (is_sealed) {
+                    list.Seal();
+                }
+                const string hint = "count "s + to_string(count) + (is_sealed ? " sealed"s : ""s)
+                                    + " level "s + to_string(static_cast<int>(level));
+                const PostingListView view = list.GetView();
+                ASSERT_HINT(view.size() == count && view.empty() == (count == 0), hint);
+                vector<Posting> postings;
+                view.ForEach([&postings](const Posting& posting) { postings.push_back(posting); });
+                ASSERT_HINT(AreSamePostings(postings, expected), hint);
+                postings.clear();
+                for (PostingListCursor cursor(view); !cursor.IsEnd(); cursor.Next()) {
+                    postings.push_back(*cursor);
+                }
+                ASSERT_HINT(AreSamePostings(postings, expected), hint);
+                if (count > 2) {
+                    const uint32_t first = expected[count / 3].ordinal;
+                    const uint32_t last = expected[count * 2 / 3].ordinal + 1;
+                    postings.clear();
+                    view.ForEachInRange(first, last, [&postings](const Posting& posting) {
+                        postings.push_back(posting);
+                    });
+                    ASSERT_HINT(AreSamePostings(postings, vector<Posting>(expected.begin() + count / 3,
+                                                                          expected.begin() + count * 2 / 3 + 1)),
+                                hint);
+                }
+            }
+        }
+    }
+    SetMaxSimdLevel(SimdLevel::AVX2);
+}
+
+// SkipTo lands on the first posting at or past the target, whether that is in the same
+// block, several skip table entries ahead, in the uncompressed tail or past the end.
+void TestPostingListCursorSkipTo() {
+    mt19937 generator(11);
+    const auto lower_bound_of = [](const vector<Posting>& postings, uint32_t ordinal) {
+        return lower_bound(postings.begin(), postings.end(), ordinal, [](const Posting& posting, uint32_t value) {
+            return posting.ordinal < value;
+        }) - postings.begin();
+    };
+    for (size_t count : {0, 1, 128, 300, 2000}) {
+        const vector<Posting> expected = MakeTestPostings(generator, count);
+        PostingList list;
+        for (const Posting& posting : expected) {
+            list.Append(posting);
+        }
+        const string hint = "count "s + to_string(count);
+        PostingListCursor empty_check(list.GetView());
+        ASSERT_HINT(empty_check.IsEnd() == (count == 0), hint);
+        empty_check.SkipTo(0);
+        ASSERT_HINT(empty_check.IsEnd() == (count == 0), hint);
+
+        for (int round = 0; round < 20; ++round) {
+            PostingListCursor cursor(list.GetView());
+            size_t position = 0;
+            uint32_t target = 0;
+            while (true) {
+                const uint32_t last_ordinal = count == 0 ? 0 : expected.back().ordinal;
+                target += uniform_int_distribution<uint32_t>(0, 1 + last_ordinal / 8)(generator);
+                if (round % 2 == 0 && position < count) {
+                    // Exact hits and the ordinal right after a posting too.
+                    target = max(target, expected[min(count - 1, position + round)].ordinal + round % 4 / 2);
+                }
+                cursor.SkipTo(target);
+                position = max<size_t>(position, lower_bound_of(expected, target));
+                if (position == count) {
+                    ASSERT_HINT(cursor.IsEnd(), hint);
+                    break;
+                }
+                ASSERT_HINT(!cursor.IsEnd() && IsSamePosting(*cursor, expected[position]), hint);
+                if (cursor.IsEnd()) {
+                    break;
+                }
+                cursor.Next();
+                ++position;
+                ASSERT_HINT(cursor.IsEnd() == (position == count), hint);
+                if (position == count) {
+                    break;
+                }
+                ASSERT_HINT(IsSamePosting(*cursor, expected[position]), hint);
+            }
+        }
+    }
+}
+
+// Relevance is the sum over query words of term frequency times inverse document frequency.
+void TestFindTopDocumentsComputesTfIdf() {
+    SearchServer search_server("and"s);
+    search_server.AddDocument(1, "white cat and fluffy tail"s, DocumentStatus::ACTUAL, {8, -3});
+    search_server.AddDocument(2, "fluffy cat fluffy tail"s, DocumentStatus::ACTUAL, {7, 2, 7});
+    search_server.AddDocument(3, "groomed dog expressive eyes"s, DocumentStatus::ACTUAL, {5, -12, 2, 1});
+    const vector<Document> documents = search_server.FindTopDocuments("fluffy groomed cat"s);
+    ASSERT(GetIds(documents) == vector<int>({2, 3, 1}));
+    const double fluffy_idf = log(3.0 / 2);
+    const double groomed_idf = log(3.0);
+    const double cat_idf = log(3.0 / 2);
+    const vector<double> expected = {0.5 * fluffy_idf + 0.25 * cat_idf, 0.25 * groomed_idf,
+                                     0.25 * fluffy_idf + 0.25 * cat_idf};
+    for (size_t i = 0; i < min(documents.size(), expected.size()); ++i) {
+        ASSERT_HINT(abs(documents[i].relevance - expected[i]) < 1e-12, to_string(i));
+    }
+    ASSERT(documents[0].rating == 5 && documents[1].rating == -1 && documents[2].rating == 2);
+}
+
+// Relevances closer than epsilon are a tie decided by rating, then by id, whatever order the
+// documents arrive in.
+void TestTopDocumentsBreaksNearTies() {
+    const vector<Document> documents = {{186, 0.5, 3}, {183, 0.5 + 1e-9, 7}, {126, 0.5 - 1e-9, 5},
+                                        {447, 0.5, 1}, {567, 0.5 + 5e-7, 2}, {10, 0.1, 9}, {11, 0.9, 0}};
+    const vector<int> expected = {11, 183, 126, 186, 567};
+    for (size_t shift = 0; shift < documents.size(); ++shift) {
+        TopDocuments top_documents(5);
+        for (size_t i = 0; i < documents.size(); ++i) {
+            top_documents.Add(documents[(i + shift) % documents.size()]);
+        }
+        ASSERT_HINT(GetIds(top_documents.Release()) == expected, "shift "s + to_string(shift));
+    }
+
+    TopDocuments merged(3);
+    TopDocuments first(3);
+    TopDocuments second(3);
+    for (const Document& document : {Document{1, 0.5, 1}, Document{2, 0.5, 1}}) {
+        first.Add(document);
+    }
+    for (const Document& document : {Document{3, 0.5 + 1e-9, 1}, Document{4, 0.5, 2}}) {
+        second.Add(document);
+    }
+    merged.Merge(second);
+    merged.Merge(first);
+    ASSERT(GetIds(merged.Release()) == vector<int>({4, 1, 2}));
+}
+
+void TestFindTopDocumentsOrdersTiesByRating() {
+    SearchServer search_server(""s);
+    for (int id = 0; id < 8; ++id) {
+        search_server.AddDocument(id, "white cat"s, DocumentStatus::ACTUAL, {id % 3});
+    }
+    search_server.AddDocument(8, "black dog"s, DocumentStatus::ACTUAL, {9});
+    ASSERT(GetIds(search_server.FindTopDocuments("cat"s)) == vector<int>({2, 5, 1, 4, 7}));
+}
+
+// Parallel scoring splits the ordinals into ranges with a heap each; merging them must keep
+// the order the sequential scan produces, ties included.
+void TestParallelFindMatchesSequential() {
+    SearchServer search_server(""s);
+    search_server.SetThreadPool(make_shared<ThreadPool>(3));
+    const int document_count = 20000;
+    // Added in descending id order, so the lowest ids come last in every range.
+    vector<int> expected;
+    for (int id = document_count - 1; id >= 0; --id) {
+        search_server.AddDocument(id, "white cat"s, DocumentStatus::ACTUAL, {id * 7 % 11});
+        if (id == document_count / 2) {
+            search_server.Flush();
+        }
+    }
+    for (int id = 0; expected.size() < 50; ++id) {
+        if (id * 7 % 11 == 10) {
+            expected.push_back(id);
+        }
+    }
+    for (size_t max_count : {1, 5, 50}) {
+        search_server.SetMaxResultDocumentCount(max_count);
+        const vector<Document> sequential = search_server.FindTopDocuments(execution::seq, "cat"s);
+        const vector<Document> parallel = search_server.FindTopDocuments(execution::par, "cat"s);
+        const string hint = "max count "s + to_string(max_count);
+        ASSERT_HINT(GetIds(sequential) == vector<int>(expected.begin(), expected.begin() + max_count), hint);
+        ASSERT_HINT(GetIds(parallel) == GetIds(sequential), hint);
+        const auto predicate = [](int document_id, DocumentStatus, int) { return document_id % 2 == 1; };
+        ASSERT_HINT(GetIds(search_server.FindTopDocuments(execution::par, "cat"s, predicate))
+                        == GetIds(search_server.FindTopDocuments(execution::seq, "cat"s, predicate)),
+                    hint);
+    }
+}
+
+// Bulk adds, sequential or parallel and split by flushes, index what AddDocument one by one
+// does, and keep nothing of the texts they were given.
+void TestAddDocumentsMatchesAddDocument() {
+    mt19937 generator(20240702);
+    vector<string> texts(2500);
+    for (string& text : texts) {
+        for (int i = uniform_int_distribution<int>(1, 10)(generator); i > 0; --i) {
+            text += "w"s + to_string(uniform_int_distribution<int>(0, 300)(generator)) + " "s;
+        }
+    }
+    vector<NewDocument> batch;
+    for (size_t i = 0; i < texts.size(); ++i) {
+        const int id = static_cast<int>(i) * 3 + 1;
+        const DocumentStatus status = i % 9 == 0 ? DocumentStatus::IRRELEVANT : DocumentStatus::ACTUAL;
+        batch.push_back({id, texts[i], status, {static_cast<int>(i % 11) - 5, 2}});
+    }
+
+    SearchServer single_server(""s);
+    SearchServer sequential_server(""s);
+    SearchServer parallel_server(""s);
+    for (SearchServer* search_server : {&single_server, &sequential_server, &parallel_server}) {
+        search_server->SetFlushThreshold(700);
+        search_server->SetThreadPool(make_shared<ThreadPool>(3));
+        search_server->SetMaxResultDocumentCount(40);
+    }
+    for (const NewDocument& document : batch) {
+        single_server.AddDocument(document.id, document.text, document.status, document.ratings);
+    }
+    sequential_server.AddDocuments(execution::seq, batch);
+    parallel_server.AddDocuments(execution::par, batch);
+    batch.clear();
+    texts.assign(texts.size(), string(20, 'x'));
+
+    const vector<int> expected_ids(single_server.begin(), single_server.end());
+    for (const SearchServer* search_server : {&sequential_server, &parallel_server}) {
+        ASSERT(search_server->GetDocumentCount() == single_server.GetDocumentCount());
+        ASSERT(vector<int>(search_server->begin(), search_server->end()) == expected_ids);
+        for (const string& query : {"w0"s, "w7 w150 -w3"s, "w299 w42 w42 w1"s}) {
+            const vector<Document> expected = single_server.FindTopDocuments(query);
+            const vector<Document> found = search_server->FindTopDocuments(query);
+            bool is_same = found.size() == expected.size();
+            for (size_t i = 0; is_same && i < found.size(); ++i) {
+                is_same = found[i].id == expected[i].id && found[i].rating == expected[i].rating
+                          && abs(found[i].relevance - expected[i].relevance) < 1e-12;
+            }
+            ASSERT_HINT(is_same, query);
+        }
+        for (const int id : {1, 1501, 7498}) {
+            ASSERT(search_server->GetWordFrequencies(id) == single_server.GetWordFrequencies(id));
+        }
+    }
+}
+
+// A batch with an invalid document is rejected whole: nothing of it is indexed, and the same
+// ids can be added afterwards.
+void TestAddDocumentsRejectsWholeBatch() {
+    const auto check = [](const auto& policy, const string& policy_name) {
+        SearchServer search_server(""s);
+        search_server.SetFlushThreshold(2);
+        search_server.AddDocument(1, "old cat"s, DocumentStatus::ACTUAL, {1});
+        const vector<vector<NewDocument>> invalid_batches = {
+            {{2, "new cat"sv, DocumentStatus::ACTUAL, {1}}, {3, "new dog"sv, DocumentStatus::ACTUAL, {1}},
+             {4, "new b\x02ird"sv, DocumentStatus::ACTUAL, {1}}, {5, "new fish"sv, DocumentStatus::ACTUAL, {1}}},
+            {{2, "new cat"sv, DocumentStatus::ACTUAL, {1}}, {1, "new dog"sv, DocumentStatus::ACTUAL, {1}}},
+            {{2, "new cat"sv, DocumentStatus::ACTUAL, {1}}, {2, "new dog"sv, DocumentStatus::ACTUAL, {1}}},
+            {{2, "new cat"sv, DocumentStatus::ACTUAL, {1}}, {-3, "new dog"sv, DocumentStatus::ACTUAL, {1}}},
+        };
+        for (size_t i = 0; i < invalid_batches.size(); ++i) {
+            const string hint = policy_name + " batch "s + to_string(i);
+            bool is_rejected = false;
+            try {
+                search_server.AddDocuments(policy, invalid_batches[i]);
+            } catch (const invalid_argument&) {
+                is_rejected = true;
+            }
+            ASSERT_HINT(is_rejected, hint);
+            ASSERT_HINT(search_server.GetDocumentCount() == 1, hint);
+            ASSERT_HINT(vector<int>(search_server.begin(), search_server.end()) == vector<int>({1}), hint);
+            ASSERT_HINT(search_server.FindTopDocuments("new cat"s).size() == 1, hint);
+            ASSERT_HINT(search_server.GetWordFrequencies(2).empty(), hint);
+        }
+        search_server.AddDocuments(policy, {{2, "new cat"sv, DocumentStatus::ACTUAL, {1}},
+                                            {3, "new dog"sv, DocumentStatus::ACTUAL, {1}}});
+        ASSERT_HINT(GetIds(search_server.FindTopDocuments("new"s)) == vector<int>({2, 3}), policy_name);
+    };
+    check(execution::seq, "seq"s);
+    check(execution::par, "par"s);
+}
+
+// Random documents over segments and the in-memory index, some of them removed or not
+// ACTUAL, with words about as skewed as natural text, and queries over the same words.
+SearchServer MakeRandomServer(mt19937& generator, vector<string>& queries) {
+    const auto random_word = [&generator]() {
+        return "w"s + to_string(static_cast<int>(exp(uniform_real_distribution<double>(0.0, log(300.0))(generator))) - 1);
+    };
+    SearchServer search_server("and in"s);
+    search_server.SetFlushThreshold(700);
+    search_server.SetThreadPool(make_shared<ThreadPool>(3));
+    for (int id = 0; id < 3000; ++id) {
+        string text;
+        for (int i = uniform_int_distribution<int>(1, 12)(generator); i > 0; --i) {
+            text += random_word() + (i % 5 == 0 ? " and "s : " "s);
+        }
+        const DocumentStatus status = id % 7 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        search_server.AddDocument(id, text, status, {uniform_int_distribution<int>(-5, 5)(generator)});
+        if (id % 9 == 0) {
+            search_server.RemoveDocument(id / 2);
+        }
+    }
+    queries = {""s, "and"s, "-w1"s, "w0 w0 -w0"s, "unknown"s, "w3 and in w5"s, "w0"s, "w0"s};
+    for (int i = 0; i < 300; ++i) {
+        string query;
+        for (int j = uniform_int_distribution<int>(1, 5)(generator); j > 0; --j) {
+            query += (uniform_int_distribution<int>(0, 5)(generator) == 0 ? "-"s : ""s) + random_word() + " "s;
+        }
+        queries.push_back(query);
+    }
+    return search_server;
+}
+
+// Every batch entry point answers each query as FindTopDocuments(query) does, cached or not,
+// at any result count.
+void TestBatchMatchesSingleQueries() {
+    mt19937 generator(20240820);
+    vector<string> queries;
+    SearchServer search_server = MakeRandomServer(generator, queries);
+    ThreadPool thread_pool(2);
+    for (const size_t max_count : {0, 1, 5, 40}) {
+        search_server.SetMaxResultDocumentCount(max_count);
+        search_server.SetQueryCacheCapacity(max_count == 5 ? 64 : 0);
+        vector<vector<Document>> expected;
+        vector<Document> expected_joined;
+        for (const string& query : queries) {
+            expected.push_back(search_server.FindTopDocuments(query));
+            expected_joined.insert(expected_joined.end(), expected.back().begin(), expected.back().end());
+        }
+        const string hint = "max count "s + to_string(max_count);
+        const auto check = [&](const vector<vector<Document>>& results, const string& name) {
+            bool is_same = results.size() == expected.size();
+            for (size_t i = 0; is_same && i < results.size(); ++i) {
+                is_same = AreSameDocuments(results[i], expected[i]);
+            }
+            ASSERT_HINT(is_same, name + ", "s + hint);
+        };
+        const auto check_joined = [&](const BatchResults& results, const string& name) {
+            bool is_same = AreSameDocuments(results.documents, expected_joined)
+                           && results.offsets.size() == expected.size() + 1;
+            for (size_t i = 0; is_same && i < expected.size(); ++i) {
+                is_same = results.offsets[i + 1] - results.offsets[i] == expected[i].size();
+            }
+            ASSERT_HINT(is_same, name + ", "s + hint);
+        };
+        check(search_server.FindTopDocumentsBatch(queries), "batch"s);
+        check(search_server.FindTopDocumentsBatch(execution::seq, queries), "seq batch"s);
+        check(search_server.FindTopDocumentsBatch(execution::par, queries), "par batch"s);
+        check(search_server.FindTopDocumentsBatch(thread_pool, queries), "pool batch"s);
+        check(ProcessQueries(search_server, queries), "ProcessQueries"s);
+        check(ProcessQueries(thread_pool, search_server, queries), "pool ProcessQueries"s);
+        check_joined(search_server.FindTopDocumentsBatchJoined(execution::seq, queries), "seq joined"s);
+        check_joined(search_server.FindTopDocumentsBatchJoined(execution::par, queries), "par joined"s);
+        check_joined(search_server.FindTopDocumentsBatchJoined(thread_pool, queries), "pool joined"s);
+        ASSERT_HINT(AreSameDocuments(ProcessQueriesJoined(search_server, queries), expected_joined), hint);
+        ASSERT_HINT(AreSameDocuments(ProcessQueriesJoined(thread_pool, search_server, queries), expected_joined), hint);
+    }
+}
+
+// Splitting each query over the pool gives what spreading queries over it does, for posting
+// lists long enough to be cut into several ranges and for lists of a few postings.
+void TestIntraQueryBatchesMatchInterQuery() {
+    mt19937 generator(20240905);
+    SearchServer search_server("of"s);
+    search_server.SetThreadPool(make_shared<ThreadPool>(3));
+    search_server.SetMaxResultDocumentCount(20);
+    for (int id = 0; id < 40'000; ++id) {
+        string text = "common of m"s + to_string(id % 50) + " r"s + to_string(uniform_int_distribution<int>(0, 9999)(generator));
+        if (id % 3 == 0) {
+            text += " half"s;
+        }
+        search_server.AddDocument(id, text, id % 11 == 0 ? DocumentStatus::REMOVED : DocumentStatus::ACTUAL,
+                                  {uniform_int_distribution<int>(0, 3)(generator)});
+        if (id == 15'000 || id == 31'000) {
+            search_server.Flush();
+        }
+        if (id % 13 == 0) {
+            search_server.RemoveDocument(id / 2);
+        }
+    }
+    const vector<string> queries = {"common"s, "r17"s, "common r5 -half"s, "half m3"s, "r9999 r0 r1"s,
+                                    "-common r3"s, "m7 m8 r42"s, "common half m1 r77"s, "missing"s, "half -m4"s};
+
+    // The larger count returns every match, so a document lost at a range boundary shows.
+    for (const size_t max_count : {20, 40'000}) {
+        search_server.SetMaxResultDocumentCount(max_count);
+        search_server.SetBatchParallelism(SearchServer::BatchParallelism::INTER_QUERY);
+        const vector<vector<Document>> inter_query = search_server.FindTopDocumentsBatch(execution::par, queries);
+        search_server.SetBatchParallelism(SearchServer::BatchParallelism::INTRA_QUERY);
+        const vector<vector<Document>> intra_query = search_server.FindTopDocumentsBatch(execution::par, queries);
+        const BatchResults intra_query_joined = search_server.FindTopDocumentsBatchJoined(execution::par, queries);
+        for (size_t i = 0; i < queries.size(); ++i) {
+            const string hint = queries[i] + ", max count "s + to_string(max_count);
+            const vector<Document> expected = search_server.FindTopDocuments(queries[i]);
+            ASSERT_HINT(AreSameDocuments(inter_query[i], expected), hint);
+            ASSERT_HINT(AreSameDocuments(intra_query[i], expected), hint);
+            const vector<Document> joined(intra_query_joined.documents.begin() + intra_query_joined.offsets[i],
+                                          intra_query_joined.documents.begin() + intra_query_joined.offsets[i + 1]);
+            ASSERT_HINT(AreSameDocuments(joined, expected), hint);
+        }
+        ASSERT(intra_query[0].size() >= min<size_t>(max_count, 20'000) && !intra_query[1].empty());
+    }
+}
+
+// Scores every live document naively and keeps the best through TopDocuments, which decides
+// the order of ties for the server as well.
+vector<Document> FindTopDocumentsNaively(const map<int, tuple<vector<string>, DocumentStatus, int>>& documents,
+                                         const vector<string>& plus_words, const vector<string>& minus_words,
+                                         size_t max_count, const function<bool(int, DocumentStatus, int)>& predicate) {
+    map<string, double> document_freqs;
+    for (const auto& [document_id, document] : documents) {
+        const vector<string>& words = get<0>(document);
+        for (const string& word : plus_words) {
+            document_freqs[word] += find(words.begin(), words.end(), word) != words.end() ? 1 : 0;
+        }
+    }
+    TopDocuments top_documents(max_count);
+    for (const auto& [document_id, document] : documents) {
+        const auto& [words, status, rating] = document;
+        const auto has_word = [&words = words](const string& word) {
+            return find(words.begin(), words.end(), word) != words.end();
+        };
+        if (any_of(minus_words.begin(), minus_words.end(), has_word) || !predicate(document_id, status, rating)) {
+            continue;
+        }
+        bool is_matched = false;
+        double relevance = 0.0;
+        for (const string& word : plus_words) {
+            if (has_word(word)) {
+                is_matched = true;
+                relevance += count(words.begin(), words.end(), word) * 1.0 / words.size()
+                             * log(documents.size() / document_freqs.at(word));
+            }
+        }
+        if (is_matched) {
+            top_documents.Add({document_id, relevance, rating});
+        }
+    }
+    return top_documents.Release();
+}
+
+// The predicates scoring recognizes by type, which skip sources without a matching status,
+// give what the equivalent lambdas give.
+void TestKnownPredicatesMatchLambdas() {
+    mt19937 generator(20240903);
+    vector<string> queries;
+    SearchServer search_server = MakeRandomServer(generator, queries);
+    // Only the in-memory index has IRRELEVANT documents, no segment has any.
+    search_server.AddDocument(5000, "w0 w3 w5"s, DocumentStatus::IRRELEVANT, {1});
+    search_server.AddDocument(5001, "w1 w3"s, DocumentStatus::IRRELEVANT, {2});
+    for (const size_t max_count : {5, 4000}) {
+        search_server.SetMaxResultDocumentCount(max_count);
+        for (const string& query : queries) {
+            const string hint = "query \""s + query + "\", max count "s + to_string(max_count);
+            const auto accept_all = [](int, DocumentStatus, int) { return true; };
+            const vector<Document> all_documents = search_server.FindTopDocuments(execution::seq, query, accept_all);
+            ASSERT_HINT(AreSameDocuments(search_server.FindTopDocuments(execution::seq, query, AcceptAllPredicate{}),
+                                         all_documents), hint);
+            ASSERT_HINT(AreSameDocuments(search_server.FindTopDocuments(execution::par, query, AcceptAllPredicate{}),
+                                         all_documents), hint);
+            for (const DocumentStatus status : {DocumentStatus::ACTUAL, DocumentStatus::IRRELEVANT,
+                                                DocumentStatus::BANNED, DocumentStatus::REMOVED}) {
+                const auto has_status = [status](int, DocumentStatus document_status, int) {
+                    return document_status == status;
+                };
+                const vector<Document> documents = search_server.FindTopDocuments(execution::seq, query, has_status);
+                ASSERT_HINT(AreSameDocuments(search_server.FindTopDocuments(execution::seq, query,
+                                                                            StatusPredicate{status}),
+                                             documents), hint);
+                ASSERT_HINT(AreSameDocuments(search_server.FindTopDocuments(execution::par, query,
+                                                                            StatusPredicate{status}),
+                                             documents), hint);
+            }
+        }
+    }
+}
+
+// AttributeRangePredicate returns what the equivalent lambda returns, as values follow their
+// documents through purge, flush, background merges and snapshots. Each flush of 500 ids gets
+// values from a range of its own, so most ranges miss the bounds of whole segments, and
+// single-value ranges at the extremes of each block hit the bounds exactly.
+void TestAttributeRangeMatchesLambda() {
+    mt19937 generator(20240917);
+    SearchServer search_server(""s);
+    search_server.SetFlushThreshold(0);
+    search_server.SetThreadPool(make_shared<ThreadPool>(3));
+    search_server.AddAttributeColumn("unused"s);
+    const size_t column = search_server.AddAttributeColumn("year"s);
+    ASSERT(search_server.FindAttributeColumn("year"s) == column);
+    ASSERT(!search_server.FindAttributeColumn("month"s));
+
+    map<int, int64_t> years;
+    const auto add = [&](int id) {
+        string text;
+        for (int i = uniform_int_distribution<int>(1, 6)(generator); i > 0; --i) {
+            text += "w"s + to_string(uniform_int_distribution<int>(0, 30)(generator)) + " "s;
+        }
+        search_server.AddDocument(id, text, id % 5 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL, {id % 13});
+        years[id] = 0;
+        // Some documents keep the default value.
+        if (id % 11 != 0) {
+            years[id] = id / 500 * 1000 + uniform_int_distribution<int>(0, 999)(generator);
+            search_server.SetAttribute(id, column, years[id]);
+        }
+    };
+    const auto set = [&](int id, int64_t year) {
+        search_server.SetAttribute(id, column, year);
+        years[id] = year;
+    };
+    const auto random_live_id = [&]() {
+        auto it = years.begin();
+        advance(it, uniform_int_distribution<size_t>(0, years.size() - 1)(generator));
+        return it->first;
+    };
+    const auto check = [&](const SearchServer& server, const map<int, int64_t>& expected_years, const string& hint) {
+        for (const auto& [id, year] : expected_years) {
+            ASSERT_HINT(server.GetAttribute(id, column) == year, hint);
+        }
+        vector<pair<int64_t, int64_t>> ranges = {{0, 0}, {0, 999}, {1500, 2499}, {2000, 2999}, {9000, 9999},
+                                                 {-10'000, -1}, {numeric_limits<int64_t>::min(), 0},
+                                                 {numeric_limits<int64_t>::min(), numeric_limits<int64_t>::max()}};
+        // The smallest and largest values of each block of 1000 bound some source exactly.
+        map<int64_t, pair<int64_t, int64_t>> block_bounds;
+        for (const auto& [id, year] : expected_years) {
+            const auto it = block_bounds.emplace(year / 1000, pair{year, year}).first;
+            it->second = {min(it->second.first, year), max(it->second.second, year)};
+        }
+        for (const auto& [block, bounds] : block_bounds) {
+            ranges.push_back({bounds.first, bounds.first});
+            ranges.push_back({bounds.second, bounds.second});
+        }
+        for (const string& query : {"w0"s, "w3 w7 -w1"s, "w12 w20 w29"s, "w1 w2 w3 w4 w5 w6 w7 w8"s}) {
+            for (const auto& [min_year, max_year] : ranges) {
+                const string range_hint = hint + ", query \""s + query + "\", years "s + to_string(min_year)
+                                          + " to "s + to_string(max_year);
+                const auto is_in_range = [&expected_years, min_year = min_year, max_year = max_year](
+                        int id, DocumentStatus status, int) {
+                    const int64_t year = expected_years.at(id);
+                    return status == DocumentStatus::ACTUAL && year >= min_year && year <= max_year;
+                };
+                const vector<Document> expected = server.FindTopDocuments(execution::seq, query, is_in_range);
+                const AttributeRangePredicate predicate{column, min_year, max_year};
+                ASSERT_HINT(AreSameDocuments(server.FindTopDocuments(execution::seq, query, predicate), expected),
+                            range_hint);
+                ASSERT_HINT(AreSameDocuments(server.FindTopDocuments(execution::par, query, predicate), expected),
+                            range_hint);
+            }
+        }
+    };
+    const auto check_server = [&](const string& hint) {
+        for (const size_t max_count : {5, 10'000}) {
+            search_server.SetMaxResultDocumentCount(max_count);
+            check(search_server, years, hint + ", max count "s + to_string(max_count));
+        }
+    };
+
+    for (int id = 0; id < 4000; ++id) {
+        add(id);
+    }
+    set(7, -5000);
+    check_server("in memory"s);
+
+    for (int i = 0; i < 1500; ++i) {
+        const int id = random_live_id();
+        search_server.RemoveDocument(id);
+        years.erase(id);
+    }
+    set(random_live_id(), 123'456);
+    check_server("after purge"s);
+
+    search_server.Flush();
+    set(random_live_id(), -7);
+    check_server("after flush"s);
+
+    for (int id = 4000; id < 6000; ++id) {
+        add(id);
+        if (id % 500 == 499) {
+            search_server.Flush();
+        }
+    }
+    // Values set while the flushed segments are being merged carry over into the result.
+    set(4321, 9500);
+    search_server.RemoveDocument(5555);
+    years.erase(5555);
+    search_server.WaitForMerges();
+    check_server("after merge"s);
+
+    search_server.SetMaxResultDocumentCount(5);
+    search_server.PublishSnapshot();
+    const shared_ptr<const SearchServer> snapshot = search_server.GetSnapshot();
+    const map<int, int64_t> snapshot_years = years;
+    check(*snapshot, snapshot_years, "snapshot"s);
+    set(4321, 1);
+    set(random_live_id(), 2);
+    add(6000);
+    check(*snapshot, snapshot_years, "snapshot after changes"s);
+    check_server("after snapshot"s);
+
+    try {
+        search_server.SetAttribute(5555, column, 1);
+        ASSERT_HINT(false, "attribute of a removed document"s);
+    } catch (const out_of_range&) {
+    }
+    try {
+        search_server.GetAttribute(1, column + 1);
+        ASSERT_HINT(false, "unknown attribute column"s);
+    } catch (const out_of_range&) {
+    }
+}
+
+// MaxScore with its exhaustive fallback (seq) and range scoring (par) both return what naive
+// scoring of every document returns, on a collection with long and short posting lists
+// spread over segments and the in-memory index.
+void TestPrunedScoringMatchesNaiveScoring() {
+    mt19937 generator(20240611);
+    const auto random_word = [&generator]() {
+        // Roughly Zipf: word i is about i + 1 times rarer than word 0.
+        return "w"s + to_string(static_cast<int>(exp(uniform_real_distribution<double>(0.0, log(200.0))(generator))) - 1);
+    };
+    map<int, tuple<vector<string>, DocumentStatus, int>> documents;
+    SearchServer search_server(""s);
+    search_server.SetFlushThreshold(700);
+    search_server.SetThreadPool(make_shared<ThreadPool>(3));
+    for (int id = 0; id < 3000; ++id) {
+        vector<string> words(uniform_int_distribution<int>(1, 12)(generator));
+        string text;
+        for (string& word : words) {
+            word = random_word();
+            text += word + " "s;
+        }
+        const DocumentStatus status = id % 7 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        const int rating = uniform_int_distribution<int>(-5, 5)(generator);
+        search_server.AddDocument(id, text, status, {rating});
+        documents[id] = {words, status, rating};
+        if (id % 5 == 0 && id > 0) {
+            const int removed_id = uniform_int_distribution<int>(0, id)(generator);
+            if (documents.erase(removed_id) > 0) {
+                search_server.RemoveDocument(removed_id);
+            }
+        }
+    }
+
+    const auto is_actual = [](int, DocumentStatus status, int) { return status == DocumentStatus::ACTUAL; };
+    const auto is_odd_rated = [](int, DocumentStatus, int rating) { return rating % 2 != 0; };
+    for (int query_index = 0; query_index < 200; ++query_index) {
+        vector<string> plus_words(uniform_int_distribution<int>(1, 8)(generator));
+        vector<string> minus_words(uniform_int_distribution<int>(0, 2)(generator));
+        string raw_query;
+        for (string& word : plus_words) {
+            word = random_word();
+            raw_query += word + " "s;
+        }
+        for (string& word : minus_words) {
+            word = random_word();
+            raw_query += "-"s + word + " "s;
+        }
+        sort(plus_words.begin(), plus_words.end());
+        plus_words.erase(unique(plus_words.begin(), plus_words.end()), plus_words.end());
+        const size_t max_count = vector<size_t>{1, 5, 20}[query_index % 3];
+        search_server.SetMaxResultDocumentCount(max_count);
+
+        const vector<Document> expected = FindTopDocumentsNaively(documents, plus_words, minus_words, max_count,
+                                                                  is_actual);
+        const vector<Document> expected_odd = FindTopDocumentsNaively(documents, plus_words, minus_words, max_count,
+                                                                      is_odd_rated);
+        for (const auto& [found, reference] : {pair{search_server.FindTopDocuments(execution::seq, raw_query), &expected},
+                                              pair{search_server.FindTopDocuments(execution::par, raw_query), &expected},
+                                              pair{search_server.FindTopDocuments(execution::seq, raw_query, is_odd_rated), &expected_odd},
+                                              pair{search_server.FindTopDocuments(execution::par, raw_query, is_odd_rated), &expected_odd}}) {
+            ASSERT_HINT(GetIds(found) == GetIds(*reference), raw_query);
+            for (size_t i = 0; i < min(found.size(), reference->size()); ++i) {
+                ASSERT_HINT(abs(found[i].relevance - (*reference)[i].relevance) < 1e-9, raw_query);
+            }
+        }
+    }
+}
+
+vector<uint8_t> BuildTestSegmentImage() {
+    SegmentBuilder builder;
+    builder.SetStopWords(vector<string>{"and"s, "the"s});
+    const vector<pair<int, vector<pair<string, uint32_t>>>> documents = {
+        {42, {{"cat"s, 3}, {"tail"s, 1}}}, {7, {{"cat"s, 1}, {"dog"s, 1}}}, {19, {{"dog"s, 3}}}};
+    for (const auto& [document_id, words] : documents) {
+        const uint32_t ordinal = builder.AddDocument(document_id, document_id % 5,
+                                                     document_id == 19 ? DocumentStatus::BANNED
+                                                                       : DocumentStatus::ACTUAL, 0.25);
+        for (const auto& [word, term_count] : words) {
+            builder.AddPosting(word, {ordinal, term_count});
+        }
+    }
+    return builder.Build();
+}
+
+// Touches every part of a segment the accessors can reach.
+size_t ReadWholeSegment(const IndexSegment& segment) {
+    size_t checksum = segment.GetStopWords().size();
+    for (TermId term_id = 0; term_id < segment.GetTermCount(); ++term_id) {
+        checksum += segment.FindTerm(segment.GetWord(term_id)).has_value();
+        for (PostingListCursor cursor(segment.GetPostings(term_id)); !cursor.IsEnd(); cursor.Next()) {
+            checksum += segment.GetDocumentIds()[cursor->ordinal] + cursor->term_count;
+        }
+    }
+    for (uint32_t ordinal = 0; ordinal < segment.GetDocumentCount(); ++ordinal) {
+        checksum += segment.FindOrdinal(segment.GetDocumentIds()[ordinal]).value_or(0);
+        checksum += static_cast<size_t>(segment.GetStatuses()[ordinal]) + segment.GetRatings()[ordinal];
+        const auto [first, last] = segment.GetForwardEntries(ordinal);
+        for (auto entry = first; entry != last; ++entry) {
+            checksum += segment.GetWord(entry->term_id).size() + entry->term_count;
+        }
+    }
+    return checksum;
+}
+
+void TestSegmentRoundTrip() {
+    const auto segment = IndexSegment::FromImage(BuildTestSegmentImage());
+    SegmentBuilder builder;
+    builder.SetStopWords(vector<string>{"the"s});
+    builder.AddPosting("cat"sv, {builder.AddDocument(42, 1, DocumentStatus::ACTUAL, 0.5), 1});
+    ASSERT(ReadWholeSegment(*builder.BuildSegment()) == ReadWholeSegment(*IndexSegment::FromImage(builder.Build())));
+    ASSERT(segment->GetDocumentCount() == 3);
+    ASSERT(segment->GetTermCount() == 3);
+    ASSERT(segment->GetStopWords() == vector<string_view>({"and"sv, "the"sv}));
+    ASSERT(segment->GetWord(*segment->FindTerm("dog"sv)) == "dog"sv);
+    ASSERT(!segment->FindTerm("bird"sv));
+    ASSERT(segment->FindOrdinal(19) == 2u);
+    ASSERT(!segment->FindOrdinal(8));
+    ASSERT(segment->GetStatuses()[2] == DocumentStatus::BANNED);
+    ASSERT(segment->GetPostings(*segment->FindTerm("cat"sv)).size() == 2);
+    const auto [first, last] = segment->GetForwardEntries(0);
+    ASSERT(last - first == 2);
+    ASSERT(segment->GetWord(first->term_id) == "cat"sv && first->term_count == 3);
+
+    SearchServer search_server(segment);
+    ASSERT(GetIds(search_server.FindTopDocuments("cat dog the"s)) == vector<int>({42, 7}));
+    ASSERT(GetIds(search_server.FindTopDocuments("dog"s, DocumentStatus::BANNED)) == vector<int>({19}));
+}
+
+// Damaged images are rejected when opened or when the damaged part is first read, and stay
+// readable within their bounds otherwise. Postings and forward entries are only checked once
+// read, so some damage goes unnoticed until then.
+void TestSegmentRejectsCorruptImages() {
+    const vector<uint8_t> image = BuildTestSegmentImage();
+    const auto is_rejected = [](vector<uint8_t> damaged) {
+        try {
+            IndexSegment::FromImage(move(damaged));
+        } catch (const invalid_argument&) {
+            return true;
+        }
+        return false;
+    };
+    ASSERT(!is_rejected(image));
+    for (size_t size : {size_t{0}, size_t{8}, size_t{40}, image.size() / 2, image.size() - 1}) {
+        ASSERT_HINT(is_rejected(vector<uint8_t>(image.begin(), image.begin() + size)), "size "s + to_string(size));
+    }
+    vector<uint8_t> damaged = image;
+    damaged[0] = 'X';
+    ASSERT(is_rejected(damaged));
+    damaged = image;
+    ++damaged[8];
+    ASSERT_HINT(is_rejected(damaged), "version"s);
+
+    vector<uint8_t> rejected_on_read;
+    for (size_t position = 0; position < image.size(); ++position) {
+        for (uint8_t value : {uint8_t{0}, uint8_t{1}, uint8_t{0x7f}, uint8_t{0xff}}) {
+            damaged = image;
+            damaged[position] = value;
+            shared_ptr<const IndexSegment> segment;
+            try {
+                segment = IndexSegment::FromImage(damaged);
+            } catch (const invalid_argument&) {
+                continue;
+            }
+            try {
+                ReadWholeSegment(*segment);
+            } catch (const invalid_argument&) {
+                rejected_on_read = damaged;
+            }
+        }
+    }
+    ASSERT(!rejected_on_read.empty());
+
+    // Mapped files are checked the same way.
+    const string path = (filesystem::temp_directory_path() / "search_server_tests_segment"s).string();
+    for (const vector<uint8_t>& contents : {image, rejected_on_read}) {
+        ofstream(path, ios::binary).write(reinterpret_cast<const char*>(contents.data()), contents.size());
+        const auto segment = IndexSegment::Open(path);
+        bool is_thrown = false;
+        try {
+            ASSERT(ReadWholeSegment(*segment) == ReadWholeSegment(*IndexSegment::FromImage(image)));
+        } catch (const invalid_argument&) {
+            is_thrown = true;
+        }
+        ASSERT(is_thrown == (contents != image));
+    }
+    filesystem::remove(path);
+}
+
+// Word frequencies are built on first request and stay put while their document lives in
+// memory, moves into a segment and is merged.
+void TestWordFrequenciesSurviveFlushAndMerge() {
+    SearchServer search_server(""s);
+    search_server.SetFlushThreshold(0);
+    search_server.AddDocument(1, "white cat white dog"s, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(2, "black dog"s, DocumentStatus::ACTUAL, {1});
+    const map<string_view, double> expected = {{"cat"sv, 0.25}, {"dog"sv, 0.25}, {"white"sv, 0.5}};
+    const map<string_view, double>& word_freqs = search_server.GetWordFrequencies(1);
+    ASSERT(word_freqs == expected);
+
+    search_server.RemoveDocument(2);
+    search_server.Flush();
+    for (int id = 3; id < 9; ++id) {
+        search_server.AddDocument(id, "black dog "s + to_string(id), DocumentStatus::ACTUAL, {1});
+        if (id % 2 == 0) {
+            search_server.Flush();
+        }
+    }
+    search_server.WaitForMerges();
+    ASSERT(word_freqs == expected);
+    ASSERT(&search_server.GetWordFrequencies(1) == &word_freqs);
+    ASSERT(search_server.GetWordFrequencies(2).empty());
+
+    const map<string_view, double>& segment_word_freqs = search_server.GetWordFrequencies(4);
+    ASSERT(segment_word_freqs.at("4"sv) == 1.0 / 3);
+    search_server.AddDocument(9, "white cat"s, DocumentStatus::ACTUAL, {1});
+    search_server.Flush();
+    search_server.WaitForMerges();
+    ASSERT(segment_word_freqs.size() == 3 && segment_word_freqs.at("black"sv) == 1.0 / 3);
+}
+
+// Words of frequency maps go away with the last map using them, so documents coming and
+// going with words of their own leave the heap where it was.
+void TestWordFrequenciesReleaseWords() {
+    SearchServer search_server(""s);
+    search_server.SetFlushThreshold(0);
+    search_server.AddDocument(0, "shared words"s, DocumentStatus::ACTUAL, {1});
+    const map<string_view, double>& kept_word_freqs = search_server.GetWordFrequencies(0);
+    const string padding(100, 'w');
+    const auto churn = [&](int first_id, int count) {
+        for (int id = first_id; id < first_id + count; ++id) {
+            search_server.AddDocument(id, "shared "s + padding + to_string(id), DocumentStatus::ACTUAL, {1});
+            ASSERT(search_server.GetWordFrequencies(id).size() == 2);
+            search_server.RemoveDocument(id);
+        }
+        search_server.Flush();
+        search_server.WaitForMerges();
+    };
+
+    churn(1, 4000);
+    const long long heap_bytes = mallinfo2().uordblks;
+    churn(4001, 4000);
+    churn(8001, 4000);
+    const long long growth = static_cast<long long>(mallinfo2().uordblks) - heap_bytes;
+    ASSERT_HINT(growth < 100'000, "heap grew by "s + to_string(growth) + " bytes"s);
+    ASSERT(search_server.GetDocumentCount() == 1);
+    ASSERT(kept_word_freqs.size() == 2 && kept_word_freqs.at("shared"sv) == 0.5);
+}
+
+// A reader keeps querying the latest snapshot while the writer adds, removes, flushes and
+// merges: each snapshot holds exactly the documents of one published round.
+void TestSnapshotsStayConsistentUnderWrites() {
+    constexpr int round_count = 200;
+    constexpr int round_size = 10;
+    SearchServer search_server(""s);
+    search_server.SetFlushThreshold(round_size * 3);
+    search_server.SetMaxResultDocumentCount(round_size * 3);
+    const auto add_round = [&search_server](int round) {
+        for (int id = round * round_size; id < (round + 1) * round_size; ++id) {
+            search_server.AddDocument(id, "common round"s + to_string(round), DocumentStatus::ACTUAL, {id});
+        }
+    };
+    add_round(0);
+    search_server.PublishSnapshot();
+
+    atomic<bool> is_writing{true};
+    int checked_count = 0;
+    int inconsistent_count = 0;
+    thread reader([&] {
+        while (is_writing) {
+            const shared_ptr<const SearchServer> snapshot = search_server.GetSnapshot();
+            const vector<int> ids(snapshot->begin(), snapshot->end());
+            vector<int> found_ids;
+            bool is_consistent = !ids.empty() && ids.size() <= 2 * round_size
+                    && static_cast<size_t>(snapshot->GetDocumentCount()) == ids.size()
+                    && ids.front() % round_size == 0 && ids.back() == ids.front() + static_cast<int>(ids.size()) - 1;
+            for (const Document& document : snapshot->FindTopDocuments("common"s)) {
+                found_ids.push_back(document.id);
+                is_consistent = is_consistent && document.rating == document.id;
+            }
+            sort(found_ids.begin(), found_ids.end());
+            is_consistent = is_consistent && found_ids == ids
+                    && snapshot->FindTopDocuments("common"s).size() == ids.size();
+            inconsistent_count += is_consistent ? 0 : 1;
+            ++checked_count;
+        }
+    });
+
+    for (int round = 1; round < round_count; ++round) {
+        add_round(round);
+        if (round >= 2) {
+            for (int id = (round - 2) * round_size; id < (round - 1) * round_size; ++id) {
+                search_server.RemoveDocument(id);
+            }
+        }
+        search_server.PublishSnapshot();
+    }
+    search_server.WaitForMerges();
+    is_writing = false;
+    reader.join();
+
+    ASSERT(checked_count > 0);
+    ASSERT_HINT(inconsistent_count == 0, to_string(inconsistent_count) + " of "s + to_string(checked_count));
+    const shared_ptr<const SearchServer> last_snapshot = search_server.GetSnapshot();
+    const vector<int> last_ids(last_snapshot->begin(), last_snapshot->end());
+    ASSERT(last_ids.size() == 2 * round_size && last_ids.front() == (round_count - 2) * round_size);
+}
+
+void TestSearchServerIsMovable() {
+    SearchServer source("and"s);
+    source.SetQueryCacheCapacity(4);
+    source.AddDocument(1, "white cat and dog"s, DocumentStatus::ACTUAL, {1});
+    source.Flush();
+    source.AddDocument(2, "black cat"s, DocumentStatus::ACTUAL, {5});
+    ASSERT(GetIds(source.FindTopDocuments("cat"s)) == vector<int>({2, 1}));
+
+    const SearchServer moved(move(source));
+    ASSERT(moved.GetDocumentCount() == 2);
+    ASSERT(GetIds(moved.FindTopDocuments("cat"s)) == vector<int>({2, 1}));
+    ASSERT(GetIds(moved.FindTopDocuments("and dog"s)) == vector<int>({1}));
+    ASSERT(moved.GetWordFrequencies(1).size() == 3);
+}
+
+// Documents removed before a merge are left out of the merged segment, and removals made
+// while it runs are replayed on it; either way results match an index that never had them.
+void TestMergeDropsRemovedDocuments() {
+    const vector<string> texts = {"white cat"s, "black dog"s, "white dog"s, "fluffy cat"s,
+                                  "black cat"s, "white parrot"s, "old dog"s, "cat and dog"s};
+    SearchServer search_server(""s);
+    search_server.SetFlushThreshold(0);
+    for (int id = 0; id < static_cast<int>(texts.size()); ++id) {
+        search_server.AddDocument(id, texts[id], DocumentStatus::ACTUAL, {id});
+        if (id == 2) {
+            search_server.RemoveDocument(1);
+        }
+        if (id % 2 == 1) {
+            search_server.Flush();
+        }
+    }
+    search_server.RemoveDocument(4);
+    search_server.WaitForMerges();
+    search_server.RemoveDocument(6);
+    search_server.AddDocument(1, "grey cat"s, DocumentStatus::ACTUAL, {9});
+
+    SearchServer expected_server(""s);
+    for (int id : {0, 2, 3, 5, 7}) {
+        expected_server.AddDocument(id, texts[id], DocumentStatus::ACTUAL, {id});
+    }
+    expected_server.AddDocument(1, "grey cat"s, DocumentStatus::ACTUAL, {9});
+
+    ASSERT(search_server.GetDocumentCount() == 6);
+    ASSERT(vector<int>(search_server.begin(), search_server.end()) == vector<int>({0, 1, 2, 3, 5, 7}));
+    for (const string& query : {"cat"s, "dog"s, "white -cat"s, "black cat dog parrot"s}) {
+        const vector<Document> documents = search_server.FindTopDocuments(query);
+        const vector<Document> expected = expected_server.FindTopDocuments(query);
+        ASSERT_HINT(GetIds(documents) == GetIds(expected), query);
+        for (size_t i = 0; i < min(documents.size(), expected.size()); ++i) {
+            ASSERT_HINT(abs(documents[i].relevance - expected[i].relevance) < 1e-9, query);
+        }
+    }
+}
+
+// Checks that search_server holds the documents of texts, rated id % 13, and answers queries
+// with the relevances a server built from them from scratch computes.
+void AssertMatchesFreshServer(const SearchServer& search_server, const map<int, string>& texts,
+                              const vector<string>& queries, const string& hint) {
+    SearchServer expected_server(""s);
+    for (const auto& [id, text] : texts) {
+        expected_server.AddDocument(id, text, DocumentStatus::ACTUAL, {id % 13});
+    }
+    ASSERT_HINT(search_server.GetDocumentCount() == static_cast<int>(texts.size()), hint);
+    ASSERT_HINT(vector<int>(search_server.begin(), search_server.end())
+                    == vector<int>(expected_server.begin(), expected_server.end()), hint);
+    for (const string& query : queries) {
+        for (const bool is_parallel : {false, true}) {
+            const vector<Document> documents = is_parallel ? search_server.FindTopDocuments(execution::par, query)
+                                                           : search_server.FindTopDocuments(query);
+            const vector<Document> expected = expected_server.FindTopDocuments(query);
+            const string query_hint = hint + ": "s + query + (is_parallel ? " (par)"s : ""s);
+            ASSERT_HINT(GetIds(documents) == GetIds(expected), query_hint);
+            for (size_t i = 0; i < min(documents.size(), expected.size()); ++i) {
+                ASSERT_HINT(abs(documents[i].relevance - expected[i].relevance) < 1e-9, query_hint);
+            }
+        }
+    }
+}
+
+// Removals crossing the purge threshold, 1024 removed documents making up a quarter of the
+// in-memory index, leave a server indistinguishable from one built from the survivors, before
+// and after more documents are added. Removing an unknown document keeps cached results.
+void TestPurgeKeepsLiveDocuments() {
+    mt19937 generator(20240715);
+    map<int, string> texts;
+    SearchServer search_server(""s);
+    search_server.SetFlushThreshold(0);
+    const auto add = [&](int id) {
+        string text = "u"s + to_string(id);
+        for (int i = uniform_int_distribution<int>(1, 6)(generator); i > 0; --i) {
+            text += " w"s + to_string(uniform_int_distribution<int>(0, 60)(generator));
+        }
+        search_server.AddDocument(id, text, DocumentStatus::ACTUAL, {id % 13});
+        texts[id] = text;
+    };
+    const auto check = [&](const string& hint) {
+        AssertMatchesFreshServer(search_server, texts, {"w0"s, "w5 w17 -w3"s, "w59 u3999 u17 w8"s, "u4100 w30"s},
+                                 hint);
+        SearchServer expected_server(""s);
+        for (const auto& [id, text] : texts) {
+            expected_server.AddDocument(id, text, DocumentStatus::ACTUAL, {id % 13});
+        }
+        for (const int id : {3, 17, 2048, 3999, 4100}) {
+            ASSERT_HINT(search_server.GetWordFrequencies(id) == expected_server.GetWordFrequencies(id), hint);
+        }
+    };
+
+    for (int id = 0; id < 4000; ++id) {
+        add(id);
+    }
+    vector<int> removed_ids(4000);
+    iota(removed_ids.begin(), removed_ids.end(), 0);
+    shuffle(removed_ids.begin(), removed_ids.end(), generator);
+    removed_ids.resize(1500);
+    for (size_t i = 0; i < removed_ids.size(); ++i) {
+        search_server.RemoveDocument(removed_ids[i]);
+        texts.erase(removed_ids[i]);
+        if (i + 1 == 1023 || i + 1 == 1024 || i + 1 == 1500) {
+            check(to_string(i + 1) + " removed"s);
+        }
+    }
+    for (int id = 4000; id < 4200; ++id) {
+        add(id);
+    }
+    add(removed_ids[0]);
+    check("added after purge"s);
+
+    search_server.SetQueryCacheCapacity(4);
+    search_server.FindTopDocuments("w1"s);
+    search_server.RemoveDocument(100'000);
+    search_server.FindTopDocuments("w1"s);
+    ASSERT(search_server.GetQueryCacheStats().hit_count == 1);
+}
+
+// Iteration yields the live ids in ascending order whatever mix of adds, removals, re-adds
+// and flushes is pending, including runs of changes long enough to be merged without
+// iterating. Snapshots keep the ids they were published with.
+void TestDocumentIdsFollowChanges() {
+    mt19937 generator(20240921);
+    SearchServer search_server(""s);
+    search_server.SetFlushThreshold(300);
+    set<int> ids;
+    const auto check = [](const SearchServer& server, const set<int>& expected_ids, const string& hint) {
+        ASSERT_HINT(vector<int>(server.begin(), server.end()) == vector<int>(expected_ids.begin(), expected_ids.end()),
+                    hint);
+        ASSERT_HINT(server.GetDocumentCount() == static_cast<int>(expected_ids.size()), hint);
+    };
+    const auto toggle = [&](int id) {
+        if (ids.erase(id) > 0) {
+            search_server.RemoveDocument(id);
+        } else {
+            search_server.AddDocument(id, "w"s + to_string(id % 50), DocumentStatus::ACTUAL, {1});
+            ids.insert(id);
+        }
+    };
+
+    check(search_server, ids, "empty"s);
+    for (int step = 1; step <= 6000; ++step) {
+        toggle(uniform_int_distribution<int>(0, 3000)(generator));
+        if (step % 997 == 0) {
+            search_server.Flush();
+        }
+        if (step % 613 == 0) {
+            check(search_server, ids, to_string(step) + " steps"s);
+        }
+    }
+    check(search_server, ids, "random changes"s);
+
+    // Added and removed, removed and added again, all before the next iteration.
+    toggle(10'000);
+    toggle(10'000);
+    toggle(10'001);
+    toggle(10'001);
+    toggle(10'001);
+    const int live_id = *ids.begin();
+    toggle(live_id);
+    toggle(live_id);
+    check(search_server, ids, "changes of one id"s);
+
+    for (int id = 20'000; id < 25'000; ++id) {
+        toggle(id);
+    }
+    for (int id = 0; id < 3000; id += 2) {
+        toggle(id);
+    }
+    check(search_server, ids, "long runs of changes"s);
+
+    search_server.PublishSnapshot();
+    const shared_ptr<const SearchServer> snapshot = search_server.GetSnapshot();
+    const set<int> snapshot_ids = ids;
+    toggle(live_id);
+    toggle(30'000);
+    check(*snapshot, snapshot_ids, "snapshot"s);
+    check(search_server, ids, "after snapshot"s);
+}
+
+// Inverse document frequencies cached by one query are recomputed after each kind of change
+// to the collection: adds and removals in memory and in segments, flushes and merges.
+void TestInverseDocumentFreqsFollowChanges() {
+    map<int, string> texts;
+    SearchServer search_server(""s);
+    search_server.SetFlushThreshold(0);
+    const auto add = [&](int id, const string& text) {
+        search_server.AddDocument(id, text, DocumentStatus::ACTUAL, {id % 13});
+        texts[id] = text;
+    };
+    const auto remove = [&](int id) {
+        search_server.RemoveDocument(id);
+        texts.erase(id);
+    };
+    const vector<string> queries = {"cat"s, "white dog"s, "cat dog parrot -black"s};
+    const auto change = [&](const string& name, const function<void()>& mutate) {
+        for (const string& query : queries) {
+            search_server.FindTopDocuments(query);
+            search_server.FindTopDocuments(execution::par, query);
+        }
+        mutate();
+        AssertMatchesFreshServer(search_server, texts, queries, name);
+    };
+
+    add(0, "white cat"s);
+    add(1, "black dog"s);
+    add(2, "white dog"s);
+    search_server.Flush();
+    add(3, "fluffy cat"s);
+    change("add to memory"s, [&] { add(4, "cat and dog"s); });
+    change("flush"s, [&] { search_server.Flush(); });
+    change("add after flush"s, [&] { add(5, "white parrot"s); });
+    change("remove from segment"s, [&] { remove(0); });
+    change("remove from memory"s, [&] { remove(5); });
+    change("merge"s, [&] {
+        for (int id = 6; id < 12; ++id) {
+            add(id, id % 2 == 0 ? "grey cat"s : "old dog"s);
+            search_server.Flush();
+        }
+        search_server.WaitForMerges();
+    });
+    change("remove after merge"s, [&] { remove(3); });
+    change("add after merge"s, [&] { add(12, "black parrot"s); });
+}
+
+// The cache never holds more entries than its capacity, however few of them there are.
+void TestQueryCacheKeepsCapacity() {
+    SearchServer search_server(""s);
+    for (int id = 0; id < 10; ++id) {
+        search_server.AddDocument(id, "word"s + to_string(id), DocumentStatus::ACTUAL, {1});
+    }
+    for (size_t capacity : {1, 3, 20}) {
+        search_server.SetQueryCacheCapacity(capacity);
+        for (int round = 0; round < 2; ++round) {
+            for (int id = 0; id < 10; ++id) {
+                search_server.FindTopDocuments("word"s + to_string(id));
+            }
+        }
+        const QueryCacheStats stats = search_server.GetQueryCacheStats();
+        const string hint = "capacity "s + to_string(capacity);
+        ASSERT_HINT(stats.hit_count + stats.miss_count == 20, hint);
+        ASSERT_HINT(stats.hit_count <= capacity, hint);
+    }
+
+    search_server.SetQueryCacheCapacity(1);
+    search_server.FindTopDocuments("word1"s);
+    search_server.FindTopDocuments("word1"s);
+    ASSERT(search_server.GetQueryCacheStats().hit_count == 1);
+
+    RequestQueue request_queue(search_server);
+    request_queue.AddFindRequest("word2"s);
+    request_queue.AddFindRequest("word2"s);
+    request_queue.AddFindRequest("missing"s);
+    ASSERT(request_queue.GetCacheHitRequests() == 1);
+    ASSERT(request_queue.GetNoResultRequests() == 1);
+}
+
+// Each request learns from its own lookup whether the cache answered it, so queries other
+// threads run on the server meanwhile do not count as hits of the queue.
+void TestRequestQueueCountsOwnCacheHits() {
+    SearchServer search_server(""s);
+    for (int id = 0; id < 20'000; ++id) {
+        search_server.AddDocument(id, "cat"s + to_string(id % 5) + " dog"s, DocumentStatus::ACTUAL, {1});
+    }
+    search_server.SetQueryCacheCapacity(4096);
+    search_server.FindTopDocuments("dog"s);
+
+    atomic<bool> is_querying{true};
+    thread other_client([&] {
+        while (is_querying) {
+            search_server.FindTopDocuments("dog"s);
+        }
+    });
+    RequestQueue request_queue(search_server);
+    constexpr int round_count = 500;
+    int expected_hit_count = 0;
+    bool is_hit = false;
+    for (int round = 0; round < round_count; ++round) {
+        request_queue.AddFindRequest("cat"s + to_string(round % 5));
+        expected_hit_count += round >= 5 ? 1 : 0;
+        // Scoring every document keeps misses slow, so the other client gets to run during them.
+        request_queue.AddFindRequest("dog -missing"s + to_string(round));
+        const vector<Document> found = search_server.FindTopDocuments("cat0"s, DocumentStatus::ACTUAL, is_hit);
+        ASSERT(is_hit && found.size() == 5);
+    }
+    is_querying = false;
+    other_client.join();
+    ASSERT(request_queue.GetCacheHitRequests() == expected_hit_count);
+    ASSERT(request_queue.GetNoResultRequests() == 0);
+
+    search_server.FindTopDocuments("cat0"s, DocumentStatus::BANNED, is_hit);
+    ASSERT(!is_hit);
+    search_server.FindTopDocuments("cat0"s, DocumentStatus::BANNED, is_hit);
+    ASSERT(is_hit);
+}
+
+// A throwing task, on the calling thread or a worker, surfaces from ParallelFor only after
+// every call that started has returned, and leaves the pool usable.
+void TestParallelForRethrowsTaskExceptions() {
+    ThreadPool thread_pool(3);
+    for (size_t failing_index : {size_t{0}, size_t{37}, size_t{99}, SIZE_MAX}) {
+        atomic<int> running_count{0};
+        atomic<int> finished_count{0};
+        bool is_thrown = false;
+        try {
+            thread_pool.ParallelFor(100, [&](size_t i) {
+                ++running_count;
+                thread_pool.ParallelFor(4, [](size_t) {});
+                --running_count;
+                if (i == failing_index || failing_index == SIZE_MAX) {
+                    throw runtime_error("task "s + to_string(i));
+                }
+                ++finished_count;
+            });
+        } catch (const runtime_error&) {
+            is_thrown = true;
+        }
+        const string hint = "failing index "s + to_string(failing_index);
+        ASSERT_HINT(is_thrown, hint);
+        ASSERT_HINT(running_count == 0, hint);
+        ASSERT_HINT(finished_count < 100, hint);
+    }
+
+    atomic<size_t> sum{0};
+    thread_pool.ParallelFor(1000, [&sum](size_t i) { sum += i; });
+    ASSERT(sum == 999 * 1000 / 2);
+}
+
+// Shards score with inverse document frequencies of the whole collection, so results match
+// one server holding every document, under either policy.
+void TestShardedSearchMatchesSingleServer() {
+    const vector<string> words = {"white"s, "black"s, "cat"s, "dog"s, "parrot"s, "fluffy"s, "tail"s};
+    SearchServer single_server("and"s);
+    ShardedSearchServer sharded_server("and"s, 4);
+    vector<string> texts(200);
+    vector<NewDocument> batch;
+    for (int id = 0; id < 200; ++id) {
+        string& text = texts[id];
+        for (int i = 0; i < 1 + id % 4; ++i) {
+            text += words[(id * 7 + i * 3) % words.size()] + " and "s;
+        }
+        const DocumentStatus status = id % 9 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        if (id < 100) {
+            single_server.AddDocument(id, text, status, {id % 13});
+            sharded_server.AddDocument(id, text, status, {id % 13});
+        } else {
+            batch.push_back({id, text, status, {id % 13}});
+        }
+    }
+    // A copy filled by the parallel batch, on a pool the shards share.
+    ShardedSearchServer parallel_sharded_server("and"s, 4);
+    parallel_sharded_server.SetThreadPool(make_shared<ThreadPool>(3));
+    for (int id = 0; id < 100; ++id) {
+        parallel_sharded_server.AddDocument(id, texts[id], id % 9 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL,
+                                            {id % 13});
+    }
+    single_server.AddDocuments(batch);
+    sharded_server.AddDocuments(batch);
+    parallel_sharded_server.AddDocuments(execution::par, batch);
+    for (int id = 0; id < 200; id += 11) {
+        single_server.RemoveDocument(id);
+        sharded_server.RemoveDocument(id);
+        parallel_sharded_server.RemoveDocument(id);
+    }
+    ASSERT(sharded_server.GetDocumentCount() == single_server.GetDocumentCount());
+    ASSERT(parallel_sharded_server.GetDocumentCount() == single_server.GetDocumentCount());
+
+    const auto is_even = [](int document_id, DocumentStatus, int) { return document_id % 2 == 0; };
+    for (const string& query : {"cat"s, "white dog -tail"s, "fluffy parrot black"s, "and"s, "bird"s}) {
+        const vector<Document> expected = single_server.FindTopDocuments(query);
+        for (const vector<Document>& documents : {sharded_server.FindTopDocuments(query),
+                                                  sharded_server.FindTopDocuments(execution::par, query),
+                                                  parallel_sharded_server.FindTopDocuments(query)}) {
+            ASSERT_HINT(AreSameDocuments(documents, expected), query);
+        }
+        ASSERT_HINT(GetIds(sharded_server.FindTopDocuments(query, DocumentStatus::BANNED))
+                        == GetIds(single_server.FindTopDocuments(query, DocumentStatus::BANNED)), query);
+        ASSERT_HINT(GetIds(sharded_server.FindTopDocuments(execution::par, query, is_even))
+                        == GetIds(single_server.FindTopDocuments(query, is_even)), query);
+    }
+
+    const auto is_rejected = [](auto action) {
+        try {
+            action();
+        } catch (const invalid_argument&) {
+            return true;
+        }
+        return false;
+    };
+    ASSERT(is_rejected([&] { sharded_server.FindTopDocuments("cat --dog"s); }));
+    ASSERT(is_rejected([&] { sharded_server.FindTopDocuments(execution::par, "cat -"s); }));
+    // Nothing of a rejected batch is indexed, in any shard and under both policies, and ids
+    // of removed documents can be reused.
+    const int document_count = sharded_server.GetDocumentCount();
+    const vector<vector<NewDocument>> invalid_batches = {
+        {{500, "cat"s, DocumentStatus::ACTUAL, {1}}, {501, "cat"s, DocumentStatus::ACTUAL, {1}},
+         {1, "dog"s, DocumentStatus::ACTUAL, {1}}},
+        {{500, "cat"s, DocumentStatus::ACTUAL, {1}}, {501, "cat"s, DocumentStatus::ACTUAL, {1}},
+         {501, "dog"s, DocumentStatus::ACTUAL, {1}}},
+        {{500, "cat"s, DocumentStatus::ACTUAL, {1}}, {501, "c\x03t"s, DocumentStatus::ACTUAL, {1}}},
+    };
+    for (const vector<NewDocument>& invalid_batch : invalid_batches) {
+        ASSERT(is_rejected([&] { sharded_server.AddDocuments(invalid_batch); }));
+        ASSERT(is_rejected([&] { sharded_server.AddDocuments(execution::par, invalid_batch); }));
+        ASSERT(sharded_server.GetDocumentCount() == document_count);
+        for (size_t shard_index = 0; shard_index < sharded_server.GetShardCount(); ++shard_index) {
+            ASSERT(!sharded_server.GetShard(shard_index).HasDocument(500));
+        }
+    }
+    sharded_server.AddDocuments(execution::par, {{11, "cat"s, DocumentStatus::ACTUAL, {1}},
+                                                 {500, "cat"s, DocumentStatus::ACTUAL, {1}}});
+    ASSERT(sharded_server.GetDocumentCount() == document_count + 2);
+}
+
+// Matching a query against many documents at once, through the forward index, answers each
+// as MatchDocument would, for documents in segments and in memory alike.
+void TestMatchDocumentsAgreesWithMatchDocument() {
+    SearchServer search_server("and in"s);
+    search_server.SetFlushThreshold(0);
+    const vector<string> texts = {"white cat and fluffy tail"s, "black dog"s, "cat in the hat"s,
+                                  "fluffy dog and white parrot"s, "old cat"s, "tail"s};
+    for (int id = 0; id < static_cast<int>(texts.size()); ++id) {
+        search_server.AddDocument(id, texts[id], id == 4 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL, {id});
+        if (id == 2) {
+            search_server.Flush();
+        }
+    }
+    search_server.RemoveDocument(1);
+    const vector<int> document_ids = {5, 0, 2, 3, 4, 0};
+    for (const string& query : {"fluffy cat tail"s, "white -parrot"s, "dog and hat"s, "bird"s}) {
+        for (const auto& matches : {search_server.MatchDocuments(query, document_ids),
+                                    search_server.MatchDocuments(execution::par, query, document_ids)}) {
+            ASSERT_HINT(matches.size() == document_ids.size(), query);
+            for (size_t i = 0; i < min(matches.size(), document_ids.size()); ++i) {
+                ASSERT_HINT(matches[i] == search_server.MatchDocument(query, document_ids[i]),
+                            query + " document "s + to_string(document_ids[i]));
+            }
+        }
+    }
+    // Matched words view the query, so it has to outlive them.
+    const string query = "fluffy cat tail"s;
+    const auto [words, status] = search_server.MatchDocuments(query, {0, 4})[0];
+    ASSERT(words == vector<string_view>({"cat"sv, "fluffy"sv, "tail"sv}) && status == DocumentStatus::ACTUAL);
+    ASSERT(get<1>(search_server.MatchDocuments("cat"s, {4})[0]) == DocumentStatus::BANNED);
+
+    bool is_thrown = false;
+    try {
+        search_server.MatchDocuments("cat"s, {0, 1});
+    } catch (const out_of_range&) {
+        is_thrown = true;
+    }
+    ASSERT(is_thrown);
+}
+
+// Queries of thousands of words are matched on the pool, 2500 words against a document of
+// 1000 terms being well past the 1 << 14 binary search steps that split the work, and give
+// what sequential matching does while other parallel queries share the pool.
+void TestParallelMatchDocumentSplitsLongQueries() {
+    SearchServer search_server(""s);
+    search_server.SetFlushThreshold(0);
+    search_server.SetThreadPool(make_shared<ThreadPool>(3));
+    string text;
+    for (int i = 0; i < 2000; i += 2) {
+        text += "w"s + to_string(i) + " "s;
+    }
+    search_server.AddDocument(1, text, DocumentStatus::ACTUAL, {1});
+    search_server.Flush();
+    search_server.AddDocument(2, text + "extra"s, DocumentStatus::BANNED, {2});
+    string plus_words;
+    vector<string> expected_words;
+    for (int i = 0; i < 2500; ++i) {
+        plus_words += "w"s + to_string(i) + " "s;
+        if (i % 2 == 0 && i < 2000) {
+            expected_words.push_back("w"s + to_string(i));
+        }
+    }
+    sort(expected_words.begin(), expected_words.end());
+
+    atomic<bool> is_querying{true};
+    thread other_client([&] {
+        while (is_querying) {
+            search_server.FindTopDocuments(execution::par, plus_words);
+        }
+    });
+    for (const int document_id : {1, 2}) {
+        const string hint = "document "s + to_string(document_id);
+        const string query = plus_words + "-w7"s;
+        const auto [words, status] = search_server.MatchDocument(execution::par, query, document_id);
+        ASSERT_HINT(vector<string>(words.begin(), words.end()) == expected_words, hint);
+        ASSERT_HINT(status == (document_id == 1 ? DocumentStatus::ACTUAL : DocumentStatus::BANNED), hint);
+        ASSERT_HINT(make_tuple(words, status) == search_server.MatchDocument(execution::seq, query, document_id), hint);
+        const string excluded_query = plus_words + "-w4"s;
+        ASSERT_HINT(get<0>(search_server.MatchDocument(execution::par, excluded_query, document_id)).empty(), hint);
+        const string extra_query = plus_words + "extra"s;
+        ASSERT_HINT(get<0>(search_server.MatchDocument(execution::par, extra_query, document_id)).size()
+                        == expected_words.size() + (document_id == 2 ? 1 : 0), hint);
+    }
+    is_querying = false;
+    other_client.join();
+}
+
+#define RUN_TEST(func) \
+    do { \
+        func(); \
+        cerr << #func << " done"s << endl; \
+    } while (false)
+
+}  // namespace
+
+int main() {
+    RUN_TEST(TestTokenizerMatchesNaiveSplit);
+    RUN_TEST(TestTermDictionaryInternsWords);
+    RUN_TEST(TestFindTopDocumentsComputesTfIdf);
+    RUN_TEST(TestPostingListRoundTrip);
+    RUN_TEST(TestPostingListCursorSkipTo);
+    RUN_TEST(TestTopDocumentsBreaksNearTies);
+    RUN_TEST(TestFindTopDocumentsOrdersTiesByRating);
+    RUN_TEST(TestParallelFindMatchesSequential);
+    RUN_TEST(TestAddDocumentsMatchesAddDocument);
+    RUN_TEST(TestAddDocumentsRejectsWholeBatch);
+    RUN_TEST(TestKnownPredicatesMatchLambdas);
+    RUN_TEST(TestAttributeRangeMatchesLambda);
+    RUN_TEST(TestPrunedScoringMatchesNaiveScoring);
+    RUN_TEST(TestBatchMatchesSingleQueries);
+    RUN_TEST(TestIntraQueryBatchesMatchInterQuery);
+    RUN_TEST(TestSegmentRoundTrip);
+    RUN_TEST(TestSegmentRejectsCorruptImages);
+    RUN_TEST(TestWordFrequenciesSurviveFlushAndMerge);
+    RUN_TEST(TestWordFrequenciesReleaseWords);
+    RUN_TEST(TestSnapshotsStayConsistentUnderWrites);
+    RUN_TEST(TestSearchServerIsMovable);
+    RUN_TEST(TestMergeDropsRemovedDocuments);
+    RUN_TEST(TestPurgeKeepsLiveDocuments);
+    RUN_TEST(TestDocumentIdsFollowChanges);
+    RUN_TEST(TestInverseDocumentFreqsFollowChanges);
+    RUN_TEST(TestQueryCacheKeepsCapacity);
+    RUN_TEST(TestRequestQueueCountsOwnCacheHits);
+    RUN_TEST(TestParallelForRethrowsTaskExceptions);
+    RUN_TEST(TestShardedSearchMatchesSingleServer);
+    RUN_TEST(TestMatchDocumentsAgreesWithMatchDocument);
+    RUN_TEST(TestParallelMatchDocumentSplitsLongQueries);
+    if (failure_count > 0) {
+        cerr << failure_count << " assertions failed"s << endl;
+        return 1;
+    }
+    cerr << "All tests passed"s << endl;
+    return 0;
+}
@@ -0,0 +1,224 @@
+#include "sharded_search_server.h"
+
+#include <cmath>
+#include <cstdint>
+#include <set>
+
+ShardedSearchServer::ShardedSearchServer(std::string_view stop_words_text, std::size_t shard_count)
+    : ShardedSearchServer(SplitIntoWords(stop_words_text), shard_count)
+{
+}
+
+ShardedSearchServer::ShardedSearchServer(const std::string& stop_words_text, std::size_t shard_count)
+    : ShardedSearchServer(std::string_view(stop_words_text), shard_count)
+{
+}
+
+void ShardedSearchServer::AddDocument(int document_id, std::string_view document, DocumentStatus status,
+                                      const std::vector<int>& ratings) {
+    if (document_id < 0) {
+        throw std::invalid_argument("Invalid document_id");
+    }
+    GetDocumentShard(document_id).AddDocument(document_id, document, status, ratings);
+}
+
+void ShardedSearchServer::AddDocuments(const std::vector<NewDocument>& documents) {
+    ShardedSearchServer::AddDocuments(std::execution::seq, documents);
+}
+
+void ShardedSearchServer::AddDocuments(const std::execution::sequenced_policy& policy,
+                                       const std::vector<NewDocument>& documents) {
+    AddDocumentBatch(policy, documents);
+}
+
+void ShardedSearchServer::AddDocuments(const std::execution::parallel_policy& policy,
+                                       const std::vector<NewDocument>& documents) {
+    AddDocumentBatch(policy, documents);
+}
+
+// Everything a shard would reject is checked up front, so no shard indexes its part of
+// a batch that another shard refuses.
+template <typename ExecutionPolicy>
+void ShardedSearchServer::AddDocumentBatch(const ExecutionPolicy& policy, const std::vector<NewDocument>& documents) {
+    std::set<int> batch_ids;
+    for (const NewDocument& document : documents) {
+        if (document.id < 0 || !batch_ids.insert(document.id).second
+            || GetDocumentShard(document.id).HasDocument(document.id)) {
+            throw std::invalid_argument("Invalid document_id");
+        }
+    }
+    for (const NewDocument& document : documents) {
+        if (HasControlChars(document.text)) {
+            throw std::invalid_argument("Some of documents have invalid words"s);
+        }
+    }
+
+    std::vector<std::vector<NewDocument>> shard_documents(shards_.size());
+    for (const NewDocument& document : documents) {
+        shard_documents[GetShardIndex(document.id)].push_back(document);
+    }
+    ForEachIndex(GetExecutor(policy), shards_.size(), [&](std::size_t shard_index) {
+        shards_[shard_index].AddDocuments(policy, shard_documents[shard_index]);
+    });
+}
+
+std::vector<Document> ShardedSearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status) const {
+    return ShardedSearchServer::FindTopDocuments(std::execution::seq, raw_query, status);
+}
+
+std::vector<Document> ShardedSearchServer::FindTopDocuments(const std::execution::sequenced_policy& policy,
+                                                            std::string_view raw_query, DocumentStatus status) const {
+    return ShardedSearchServer::FindTopDocuments(policy, raw_query, StatusPredicate{status});
+}
+
+std::vector<Document> ShardedSearchServer::FindTopDocuments(const std::execution::parallel_policy& policy,
+                                                            std::string_view raw_query, DocumentStatus status) const {
+    return ShardedSearchServer::FindTopDocuments(policy, raw_query, StatusPredicate{status});
+}
+
+std::vector<Document> ShardedSearchServer::FindTopDocuments(std::string_view raw_query) const {
+    return ShardedSearchServer::FindTopDocuments(std::execution::seq, raw_query);
+}
+
+std::vector<Document> ShardedSearchServer::FindTopDocuments(const std::execution::sequenced_policy& policy,
+                                                            std::string_view raw_query) const {
+    return ShardedSearchServer::FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
+}
+
+std::vector<Document> ShardedSearchServer::FindTopDocuments(const std::execution::parallel_policy& policy,
+                                                            std::string_view raw_query) const {
+    return ShardedSearchServer::FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
+}
+
+int ShardedSearchServer::GetDocumentCount() const {
+    int document_count = 0;
+    for (const auto& shard : shards_) {
+        document_count += shard.GetDocumentCount();
+    }
+    return document_count;
+}
+
+std::size_t ShardedSearchServer::GetShardCount() const {
+    return shards_.size();
+}
+
+const SearchServer& ShardedSearchServer::GetShard(std::size_t shard_index) const {
+    return shards_.at(shard_index);
+}
+
+void ShardedSearchServer::SetMaxResultDocumentCount(std::size_t max_count) {
+    max_result_document_count_ = max_count;
+    // Shards pick their scoring strategy by the number of results wanted.
+    for (auto& shard : shards_) {
+        shard.SetMaxResultDocumentCount(max_count);
+    }
+}
+
+std::size_t ShardedSearchServer::GetMaxResultDocumentCount() const {
+    return max_result_document_count_;
+}
+
+void ShardedSearchServer::SetThreadPool(std::shared_ptr<ThreadPool> thread_pool) {
+    thread_pool_ = thread_pool;
+    for (auto& shard : shards_) {
+        shard.SetThreadPool(thread_pool);
+    }
+}
+
+std::size_t ShardedSearchServer::AddAttributeColumn(std::string_view name) {
+    if (FindAttributeColumn(name)) {
+        throw std::invalid_argument("Attribute column exists");
+    }
+    std::size_t column = 0;
+    for (auto& shard : shards_) {
+        column = shard.AddAttributeColumn(name);
+    }
+    return column;
+}
+
+std::optional<std::size_t> ShardedSearchServer::FindAttributeColumn(std::string_view name) const {
+    return shards_.front().FindAttributeColumn(name);
+}
+
+void ShardedSearchServer::SetAttribute(int document_id, std::size_t column, std::int64_t value) {
+    if (document_id < 0) {
+        throw std::out_of_range("Invalid document_id");
+    }
+    GetDocumentShard(document_id).SetAttribute(document_id, column, value);
+}
+
+std::int64_t ShardedSearchServer::GetAttribute(int document_id, std::size_t column) const {
+    if (document_id < 0) {
+        throw std::out_of_range("Invalid document_id");
+    }
+    return GetDocumentShard(document_id).GetAttribute(document_id, column);
+}
+
+const std::map<std::string_view, double>& ShardedSearchServer::GetWordFrequencies(int document_id) const {
+    return GetDocumentShard(document_id).GetWordFrequencies(document_id);
+}
+
+void ShardedSearchServer::RemoveDocument(int document_id) {
+    GetDocumentShard(document_id).RemoveDocument(document_id);
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> ShardedSearchServer::MatchDocument(std::string_view raw_query,
+                                                                                           int document_id) const {
+    return GetDocumentShard(document_id).MatchDocument(raw_query, document_id);
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> ShardedSearchServer::MatchDocument(
+        const std::execution::sequenced_policy& policy, std::string_view raw_query, int document_id) const {
+    return GetDocumentShard(document_id).MatchDocument(policy, raw_query, document_id);
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> ShardedSearchServer::MatchDocument(
+        const std::execution::parallel_policy& policy, std::string_view raw_query, int document_id) const {
+    return GetDocumentShard(document_id).MatchDocument(policy, raw_query, document_id);
+}
+
+// Fibonacci hashing, so ids sharing a stride still spread evenly over the shards.
+std::size_t ShardedSearchServer::GetShardIndex(int document_id) const {
+    const std::uint64_t hash = static_cast<std::uint32_t>(document_id) * 0x9E3779B97F4A7C15ull;
+    return (hash >> 32) % shards_.size();
+}
+
+SearchServer& ShardedSearchServer::GetDocumentShard(int document_id) {
+    return shards_[GetShardIndex(document_id)];
+}
+
+const SearchServer& ShardedSearchServer::GetDocumentShard(int document_id) const {
+    return shards_[GetShardIndex(document_id)];
+}
+
+ThreadPool* ShardedSearchServer::GetExecutor(const std::execution::sequenced_policy&) const {
+    return nullptr;
+}
+
+ThreadPool* ShardedSearchServer::GetExecutor(const std::execution::parallel_policy&) const {
+    return thread_pool_ ? thread_pool_.get() : &ThreadPool::GetDefault();
+}
+
+// Shards count live documents only, as a single server would.
+std::map<std::string_view, double> ShardedSearchServer::ComputeInverseDocumentFreqs(
+        ThreadPool* executor, std::string_view raw_query) const {
+    std::vector<std::map<std::string_view, std::size_t>> shard_document_freqs(shards_.size());
+    ForEachIndex(executor, shards_.size(), [&](std::size_t shard_index) {
+        shard_document_freqs[shard_index] = shards_[shard_index].GetDocumentFreqs(raw_query);
+    });
+
+    std::map<std::string_view, std::size_t> document_freqs;
+    for (const auto& shard_freqs : shard_document_freqs) {
+        for (const auto& [word, document_freq] : shard_freqs) {
+            document_freqs[word] += document_freq;
+        }
+    }
+    const int document_count = GetDocumentCount();
+    std::map<std::string_view, double> inverse_document_freqs;
+    for (const auto& [word, document_freq] : document_freqs) {
+        if (document_freq > 0) {
+            inverse_document_freqs.emplace(word, std::log(document_count * 1.0 / document_freq));
+        }
+    }
+    return inverse_document_freqs;
+}
@@ -0,0 +1,157 @@
+#pragma once
+#include "search_server.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+// Documents partitioned over SearchServer shards by a hash of their ids. Queries run in two
+// phases: the shards' document frequencies of the query words are summed first, so every
+// shard scores with the inverse document frequencies of the whole collection, then all
+// shards score their documents and the per-shard best matches are merged. Results are those
+// of one SearchServer holding every document. As with SearchServer, queries run on the
+// calling thread unless the parallel policy is given, which spreads the shards over the pool.
+class ShardedSearchServer {
+public:
+    template <typename StringContainer>
+    ShardedSearchServer(const StringContainer& stop_words, std::size_t shard_count);
+
+    ShardedSearchServer(std::string_view stop_words_text, std::size_t shard_count);
+
+    ShardedSearchServer(const std::string& stop_words_text, std::size_t shard_count);
+
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+
+    // Throws before indexing anything if some document is invalid, like SearchServer. The
+    // parallel overload fills the shards side by side, each with its parallel AddDocuments;
+    // the one without a policy is sequential.
+    void AddDocuments(const std::vector<NewDocument>& documents);
+    void AddDocuments(const std::execution::sequenced_policy&, const std::vector<NewDocument>& documents);
+    void AddDocuments(const std::execution::parallel_policy&, const std::vector<NewDocument>& documents);
+
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate) const;
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const ExecutionPolicy& policy,
+                                           std::string_view raw_query, DocumentPredicate document_predicate) const;
+
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status) const;
+    std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy&,
+                                           std::string_view raw_query, DocumentStatus status) const;
+    std::vector<Document> FindTopDocuments(const std::execution::parallel_policy&,
+                                           std::string_view raw_query, DocumentStatus status) const;
+
+    std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
+    std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy&,
+                                           std::string_view raw_query) const;
+    std::vector<Document> FindTopDocuments(const std::execution::parallel_policy&,
+                                           std::string_view raw_query) const;
+
+    int GetDocumentCount() const;
+
+    std::size_t GetShardCount() const;
+    const SearchServer& GetShard(std::size_t shard_index) const;
+
+    void SetMaxResultDocumentCount(std::size_t max_count);
+    std::size_t GetMaxResultDocumentCount() const;
+
+    // Runs the shards of parallel queries on thread_pool, shared with the shards, instead of
+    // ThreadPool::GetDefault().
+    void SetThreadPool(std::shared_ptr<ThreadPool> thread_pool);
+
+    // Columns are added to every shard under the same index.
+    std::size_t AddAttributeColumn(std::string_view name);
+    std::optional<std::size_t> FindAttributeColumn(std::string_view name) const;
+    void SetAttribute(int document_id, std::size_t column, std::int64_t value);
+    std::int64_t GetAttribute(int document_id, std::size_t column) const;
+
+    const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
+
+    void RemoveDocument(int document_id);
+
+    // Answered by the shard holding the document alone.
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::string_view raw_query,
+                                                                            int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::sequenced_policy&,
+                                                                            std::string_view raw_query,
+                                                                            int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::parallel_policy&,
+                                                                            std::string_view raw_query,
+                                                                            int document_id) const;
+
+private:
+    std::vector<SearchServer> shards_;
+    // nullptr for ThreadPool::GetDefault().
+    std::shared_ptr<ThreadPool> thread_pool_;
+    std::size_t max_result_document_count_ = 5;
+
+    std::size_t GetShardIndex(int document_id) const;
+    SearchServer& GetDocumentShard(int document_id);
+    const SearchServer& GetDocumentShard(int document_id) const;
+
+    ThreadPool* GetExecutor(const std::execution::sequenced_policy&) const;
+    ThreadPool* GetExecutor(const std::execution::parallel_policy&) const;
+
+    template <typename ExecutionPolicy>
+    void AddDocumentBatch(const ExecutionPolicy& policy, const std::vector<NewDocument>& documents);
+
+    // Runs task(i) for every i in [0, count) on executor, or in order without one.
+    template <typename Task>
+    static void ForEachIndex(ThreadPool* executor, std::size_t count, Task task);
+
+    // Of the plus words of raw_query that some shard has; keys view raw_query. Throws
+    // std::invalid_argument for an invalid query.
+    std::map<std::string_view, double> ComputeInverseDocumentFreqs(ThreadPool* executor,
+                                                                   std::string_view raw_query) const;
+};
+
+template <typename StringContainer>
+ShardedSearchServer::ShardedSearchServer(const StringContainer& stop_words, std::size_t shard_count) {
+    if (shard_count == 0) {
+        throw std::invalid_argument("Invalid shard_count");
+    }
+    shards_.reserve(shard_count);
+    for (std::size_t i = 0; i < shard_count; ++i) {
+        shards_.emplace_back(stop_words);
+    }
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> ShardedSearchServer::FindTopDocuments(std::string_view raw_query,
+                                                            DocumentPredicate document_predicate) const {
+    return ShardedSearchServer::FindTopDocuments(std::execution::seq, raw_query, document_predicate);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> ShardedSearchServer::FindTopDocuments(const ExecutionPolicy& policy, std::string_view raw_query,
+                                                            DocumentPredicate document_predicate) const {
+    ThreadPool* executor = GetExecutor(policy);
+    const std::map<std::string_view, double> inverse_document_freqs = ComputeInverseDocumentFreqs(executor, raw_query);
+
+    std::vector<TopDocuments> shard_tops(shards_.size(), TopDocuments(max_result_document_count_));
+    ForEachIndex(executor, shards_.size(), [&](std::size_t shard_index) {
+        shards_[shard_index].ScoreDocuments(raw_query, inverse_document_freqs, document_predicate,
+                                            shard_tops[shard_index]);
+    });
+    TopDocuments top_documents(max_result_document_count_);
+    for (const TopDocuments& shard_top : shard_tops) {
+        top_documents.Merge(shard_top);
+    }
+    return top_documents.Release();
+}
+
+template <typename Task>
+void ShardedSearchServer::ForEachIndex(ThreadPool* executor, std::size_t count, Task task) {
+    if (executor) {
+        executor->ParallelFor(count, task);
+        return;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        task(i);
+    }
+}
@@ -0,0 +1,36 @@
+#include "simd.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace {
+
+SimdLevel DetectSimdLevel() {
+#if (defined(__x86_64__) || defined(_M_X64)) && defined(__GNUC__)
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return SimdLevel::SSSE3;
+    }
+    return SimdLevel::SSE2;
+#elif defined(__x86_64__) || defined(_M_X64)
+    return SimdLevel::SSE2;
+#else
+    return SimdLevel::SCALAR;
+#endif
+}
+
+std::atomic<SimdLevel> max_simd_level{SimdLevel::AVX2};
+
+} // namespace
+
+SimdLevel GetSimdLevel() {
+    // Detected on first use, so vectorized code works during static initialization too.
+    static const SimdLevel supported_level = DetectSimdLevel();
+    return std::min(supported_level, max_simd_level.load(std::memory_order_relaxed));
+}
+
+void SetMaxSimdLevel(SimdLevel level) {
+    max_simd_level.store(level, std::memory_order_relaxed);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+// x86 instruction set extensions that vectorized code picks from; each implies the ones
+// before it.
+enum class SimdLevel {
+    SCALAR,
+    SSE2,
+    SSSE3,
+    AVX2,
+};
+
+// The widest level the CPU supports, lowered to the cap set by SetMaxSimdLevel.
+SimdLevel GetSimdLevel();
+
+// Caps the level vectorized code uses from now on, so tests can run every implementation on
+// one machine. Calls already running keep the level they started with.
+void SetMaxSimdLevel(SimdLevel level);
@@ -1,17 +1,93 @@
 #include "string_processing.h"
+#include "simd.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define SEARCH_SERVER_X86_64
+#endif
+
+namespace {
+
+#ifdef SEARCH_SERVER_X86_64
+
+// SSE2 is part of x86-64, so this is the baseline there. A byte c is below the space
+// exactly when min(c, 31) == c as unsigned bytes.
+TextBlockMasks ScanTextBlockSse2(const char* block) {
+    const __m128i spaces = _mm_set1_epi8(' ');
+    const __m128i last_control_char = _mm_set1_epi8(' ' - 1);
+    TextBlockMasks masks{0, 0};
+    for (std::size_t i = 0; i < text_block_size; i += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+        const auto space_bits = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, spaces)));
+        const auto control_bits = static_cast<std::uint32_t>(_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_min_epu8(bytes, last_control_char), bytes)));
+        masks.spaces |= static_cast<std::uint64_t>(space_bits) << i;
+        masks.control_chars |= static_cast<std::uint64_t>(control_bits) << i;
+    }
+    return masks;
+}
+
+#if defined(__GNUC__)
+#define SEARCH_SERVER_AVX2
+
+__attribute__((target("avx2"))) TextBlockMasks ScanTextBlockAvx2(const char* block) {
+    const __m256i spaces = _mm256_set1_epi8(' ');
+    const __m256i last_control_char = _mm256_set1_epi8(' ' - 1);
+    TextBlockMasks masks{0, 0};
+    for (std::size_t i = 0; i < text_block_size; i += 32) {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i));
+        const auto space_bits = static_cast<std::uint32_t>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, spaces)));
+        const auto control_bits = static_cast<std::uint32_t>(_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_min_epu8(bytes, last_control_char), bytes)));
+        masks.spaces |= static_cast<std::uint64_t>(space_bits) << i;
+        masks.control_chars |= static_cast<std::uint64_t>(control_bits) << i;
+    }
+    return masks;
+}
+#endif
+
+#endif
+
+TextBlockMasks ScanTextBlockScalar(const char* block) {
+    TextBlockMasks masks{0, 0};
+    for (std::size_t i = 0; i < text_block_size; ++i) {
+        const auto c = static_cast<unsigned char>(block[i]);
+        masks.spaces |= static_cast<std::uint64_t>(c == ' ') << i;
+        masks.control_chars |= static_cast<std::uint64_t>(c < ' ') << i;
+    }
+    return masks;
+}
+
+} // namespace
+
+ScanTextBlockFunction GetScanTextBlock() {
+    const SimdLevel level = GetSimdLevel();
+#if defined(SEARCH_SERVER_AVX2)
+    if (level >= SimdLevel::AVX2) {
+        return ScanTextBlockAvx2;
+    }
+#endif
+#if defined(SEARCH_SERVER_X86_64)
+    if (level >= SimdLevel::SSE2) {
+        return ScanTextBlockSse2;
+    }
+#endif
+    return ScanTextBlockScalar;
+}
+
+TextBlockMasks ScanTextBlock(const char* block) {
+    return GetScanTextBlock()(block);
+}
+
+bool HasControlChars(std::string_view str) {
+    return !ForEachWord(str, [](std::string_view) {});
+}
 
 std::vector<std::string_view> SplitIntoWords(std::string_view str) {
     std::vector<std::string_view> result;
-    while (true) {
-        const auto space = str.find(' ');
-        if (space != 0 && !str.empty()) {
-            result.push_back(str.substr(0, space));
-        }
-        if (space == str.npos) {
-            break;
-        } else {
-            str.remove_prefix(space + 1);
-        }
-    }
+    ForEachWord(str, [&result](std::string_view word) {
+        result.push_back(word);
+    });
     return result;
-}
\ No newline at end of file
+}
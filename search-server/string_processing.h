@@ -1,4 +1,6 @@
 #pragma once
+#include <cstdint>
+#include <cstring>
 #include <vector>
 #include <string>
 #include <string_view>
@@ -6,6 +8,70 @@
 
 std::vector<std::string_view> SplitIntoWords(std::string_view str);
 
+// Bit i of a mask describes byte i of a text block.
+struct TextBlockMasks {
+    std::uint64_t spaces;
+    std::uint64_t control_chars;
+};
+
+constexpr std::size_t text_block_size = 64;
+
+// Classifies text_block_size bytes with the widest vector instructions GetSimdLevel allows.
+// Control characters are the bytes below the space.
+TextBlockMasks ScanTextBlock(const char* block);
+
+// The implementation ScanTextBlock runs at the current level, for loops over many blocks.
+using ScanTextBlockFunction = TextBlockMasks (*)(const char* block);
+ScanTextBlockFunction GetScanTextBlock();
+
+bool HasControlChars(std::string_view str);
+
+inline int CountTrailingZeros(std::uint64_t mask) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(mask);
+#else
+    int count = 0;
+    for (; (mask & 1) == 0; mask >>= 1) {
+        ++count;
+    }
+    return count;
+#endif
+}
+
+// Calls visitor with every non-empty space-separated word of str without allocating, and
+// checks in the same pass that str has no control characters. Every word is visited
+// either way; returns whether str is free of control characters.
+template <typename Visitor>
+bool ForEachWord(std::string_view str, Visitor visitor) {
+    const ScanTextBlockFunction scan_text_block = GetScanTextBlock();
+    std::size_t word_begin = 0;
+    std::uint64_t control_chars = 0;
+    for (std::size_t block_begin = 0; block_begin < str.size(); block_begin += text_block_size) {
+        TextBlockMasks masks;
+        if (str.size() - block_begin >= text_block_size) {
+            masks = scan_text_block(str.data() + block_begin);
+        } else {
+            // Padding with spaces ends the last word within the block.
+            char block[text_block_size];
+            std::memset(block, ' ', text_block_size);
+            std::memcpy(block, str.data() + block_begin, str.size() - block_begin);
+            masks = scan_text_block(block);
+        }
+        control_chars |= masks.control_chars;
+        for (std::uint64_t spaces = masks.spaces; spaces != 0; spaces &= spaces - 1) {
+            const std::size_t space = block_begin + CountTrailingZeros(spaces);
+            if (space > word_begin && word_begin < str.size()) {
+                visitor(str.substr(word_begin, space - word_begin));
+            }
+            word_begin = space + 1;
+        }
+    }
+    if (word_begin < str.size()) {
+        visitor(str.substr(word_begin));
+    }
+    return control_chars == 0;
+}
+
 template <typename StringContainer>
 std::set<std::string, std::less<>> MakeUniqueNonEmptyStrings(const StringContainer& strings) {
     std::set<std::string, std::less<>> non_empty_strings;
@@ -15,4 +81,4 @@ std::set<std::string, std::less<>> MakeUniqueNonEmptyStrings(const StringContain
         }
     }
     return non_empty_strings;
-}
\ No newline at end of file
+}
@@ -0,0 +1,78 @@
+#include "term_dictionary.h"
+
+#include <cstring>
+#include <functional>
+
+TermDictionary::TermDictionary()
+    : slots_(16, empty_slot_) {
+}
+
+TermId TermDictionary::Intern(std::string_view word) {
+    std::size_t slot = FindSlot(word);
+    if (slots_[slot] != empty_slot_) {
+        return slots_[slot] - 1;
+    }
+    const TermId term_id = static_cast<TermId>(words_.size());
+    words_.push_back(Store(word));
+    slots_[slot] = term_id + 1;
+    if (words_.size() * 2 > slots_.size()) {
+        Rehash(slots_.size() * 2);
+    }
+    return term_id;
+}
+
+std::optional<TermId> TermDictionary::Find(std::string_view word) const {
+    const std::uint32_t slot_value = slots_[FindSlot(word)];
+    if (slot_value == empty_slot_) {
+        return std::nullopt;
+    }
+    return slot_value - 1;
+}
+
+std::string_view TermDictionary::GetWord(TermId term_id) const {
+    return words_[term_id];
+}
+
+std::size_t TermDictionary::size() const {
+    return words_.size();
+}
+
+std::size_t TermDictionary::FindSlot(std::string_view word) const {
+    const std::size_t mask = slots_.size() - 1;
+    std::size_t slot = std::hash<std::string_view>{}(word) & mask;
+    while (slots_[slot] != empty_slot_ && words_[slots_[slot] - 1] != word) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void TermDictionary::Rehash(std::size_t slot_count) {
+    slots_.assign(slot_count, empty_slot_);
+    const std::size_t mask = slot_count - 1;
+    for (TermId term_id = 0; term_id < words_.size(); ++term_id) {
+        std::size_t slot = std::hash<std::string_view>{}(words_[term_id]) & mask;
+        while (slots_[slot] != empty_slot_) {
+            slot = (slot + 1) & mask;
+        }
+        slots_[slot] = term_id + 1;
+    }
+}
+
+// Words longer than a chunk get a chunk of their own, kept before the one being filled.
+std::string_view TermDictionary::Store(std::string_view word) {
+    if (word.size() > chunk_size_) {
+        auto chunk = std::make_unique<char[]>(word.size());
+        std::memcpy(chunk.get(), word.data(), word.size());
+        const std::string_view stored(chunk.get(), word.size());
+        chunks_.insert(chunks_.empty() ? chunks_.end() : chunks_.end() - 1, std::move(chunk));
+        return stored;
+    }
+    if (chunks_.empty() || word.size() > chunk_size_ - chunk_used_) {
+        chunks_.push_back(std::make_unique<char[]>(chunk_size_));
+        chunk_used_ = 0;
+    }
+    char* data = chunks_.back().get() + chunk_used_;
+    std::memcpy(data, word.data(), word.size());
+    chunk_used_ += word.size();
+    return {data, word.size()};
+}
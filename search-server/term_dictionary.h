@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+using TermId = std::uint32_t;
+
+// Maps words to dense term ids with an open-addressing hash table. Each distinct word is
+// copied once into chunks that never move, so returned views live as long as the dictionary.
+class TermDictionary {
+public:
+    TermDictionary();
+
+    TermId Intern(std::string_view word);
+
+    std::optional<TermId> Find(std::string_view word) const;
+
+    std::string_view GetWord(TermId term_id) const;
+
+    std::size_t size() const;
+
+private:
+    static constexpr std::uint32_t empty_slot_ = 0;
+    static constexpr std::size_t chunk_size_ = 64 * 1024;
+
+    std::vector<std::string_view> words_;
+    std::vector<std::uint32_t> slots_;
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    std::size_t chunk_used_ = 0;
+
+    std::size_t FindSlot(std::string_view word) const;
+
+    std::string_view Store(std::string_view word);
+
+    void Rehash(std::size_t slot_count);
+};
@@ -41,9 +41,11 @@ void FindTopDocuments(const SearchServer& search_server, std::string_view raw_qu
 void MatchDocuments(const SearchServer& search_server, std::string_view query) {
     try {
         std::cout << "Matching for request: "s << query << std::endl;
-        for (const int document_id : search_server) {
-            const auto [words, status] = search_server.MatchDocument(query, document_id);
-            PrintMatchDocumentResult(document_id, words, status);
+        const std::vector<int> document_ids(search_server.begin(), search_server.end());
+        const auto results = search_server.MatchDocuments(query, document_ids);
+        for (std::size_t i = 0; i < document_ids.size(); ++i) {
+            const auto& [words, status] = results[i];
+            PrintMatchDocumentResult(document_ids[i], words, status);
         }
     } catch (const std::exception& e) {
         std::cout << "Error in matchig request "s << query << ": "s << e.what() << std::endl;
@@ -0,0 +1,155 @@
+#include "thread_pool.h"
+
+#include <stdexcept>
+#include <utility>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+// The pool and deque index of the calling thread, if it is a worker.
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local std::size_t current_worker = 0;
+
+}  // namespace
+
+ThreadPool::ThreadPool(std::size_t thread_count, const std::vector<int>& cpus) {
+#ifdef __linux__
+    for (const int cpu : cpus) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+            throw std::invalid_argument("Invalid cpu");
+        }
+    }
+#endif
+    workers_.reserve(thread_count);
+    for (std::size_t i = 0; i < thread_count; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    for (std::size_t i = 0; i < thread_count; ++i) {
+        workers_[i]->thread = std::thread([this, i] { RunWorker(i); });
+    }
+#ifdef __linux__
+    for (std::size_t i = 0; i < thread_count && !cpus.empty(); ++i) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpus[i % cpus.size()], &cpu_set);
+        if (pthread_setaffinity_np(workers_[i]->thread.native_handle(), sizeof(cpu_set), &cpu_set) != 0) {
+            Stop();
+            throw std::invalid_argument("Invalid cpu");
+        }
+    }
+#endif
+}
+
+ThreadPool::~ThreadPool() {
+    Stop();
+}
+
+std::size_t ThreadPool::GetConcurrency() const {
+    return workers_.size() + 1;
+}
+
+ThreadPool& ThreadPool::GetDefault() {
+    static ThreadPool thread_pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return thread_pool;
+}
+
+void ThreadPool::Push(Job job) {
+    const std::size_t index = current_pool == this ? current_worker : next_worker_++ % workers_.size();
+    // Counted first, so a worker woken for the job keeps looking until it shows up.
+    ++pending_job_count_;
+    {
+        Worker& worker = *workers_[index];
+        std::lock_guard guard(worker.mutex);
+        worker.jobs.push_back(std::move(job));
+    }
+    {
+        std::lock_guard guard(sleep_mutex_);
+    }
+    wake_.notify_one();
+}
+
+bool ThreadPool::RunPendingJob() {
+    if (pending_job_count_ == 0) {
+        return false;
+    }
+    const std::size_t own = current_pool == this ? current_worker : next_worker_ % workers_.size();
+    Job job;
+    {
+        Worker& worker = *workers_[own];
+        std::lock_guard guard(worker.mutex);
+        if (!worker.jobs.empty()) {
+            job = std::move(worker.jobs.back());
+            worker.jobs.pop_back();
+        }
+    }
+    for (std::size_t i = 1; !job && i < workers_.size(); ++i) {
+        Worker& victim = *workers_[(own + i) % workers_.size()];
+        std::lock_guard guard(victim.mutex);
+        if (!victim.jobs.empty()) {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+        }
+    }
+    if (!job) {
+        return false;
+    }
+    --pending_job_count_;
+    job();
+    return true;
+}
+
+void ThreadPool::RunWorker(std::size_t index) {
+    current_pool = this;
+    current_worker = index;
+    while (true) {
+        if (RunPendingJob()) {
+            continue;
+        }
+        std::unique_lock lock(sleep_mutex_);
+        wake_.wait(lock, [this] { return is_stopping_ || pending_job_count_ > 0; });
+        if (is_stopping_ && pending_job_count_ == 0) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::Stop() {
+    {
+        std::lock_guard guard(sleep_mutex_);
+        is_stopping_ = true;
+    }
+    wake_.notify_all();
+    for (const auto& worker : workers_) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
+
+// The waiting thread sleeps on wake_ like an idle worker, so the last index wakes it
+// through the same condition variable.
+void ThreadPool::FinishIndex(Loop& loop) {
+    if (++loop.done_count == loop.count) {
+        {
+            std::lock_guard guard(sleep_mutex_);
+        }
+        wake_.notify_all();
+    }
+}
+
+// Indexes still running belong to threads that make progress on their own, so waiting
+// without helping cannot deadlock; helping only keeps this thread busy. Jobs queued while
+// it sleeps wake it like any worker.
+void ThreadPool::WaitFor(Loop& loop) {
+    while (loop.done_count < loop.count) {
+        if (RunPendingJob()) {
+            continue;
+        }
+        std::unique_lock lock(sleep_mutex_);
+        wake_.wait(lock, [this, &loop] { return loop.done_count == loop.count || pending_job_count_ > 0; });
+    }
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads with one job deque each. A worker runs the newest job of its
+// own deque first and steals the oldest job of another deque when its own is empty, so
+// nested parallel loops stay on the thread that started them until someone is idle.
+class ThreadPool {
+public:
+    // Starts thread_count workers. With cpus given, worker i is pinned to cpus[i % cpus.size()]
+    // where the platform supports it, e.g. to keep a pool on the cores of one NUMA node.
+    explicit ThreadPool(std::size_t thread_count, const std::vector<int>& cpus = {});
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    // Finishes the queued jobs and joins the workers.
+    ~ThreadPool();
+
+    // Threads running a ParallelFor: the workers and the calling thread.
+    std::size_t GetConcurrency() const;
+
+    // Runs task(i) for every i in [0, count) on the workers and the calling thread, and returns
+    // once all calls are done. Tasks may run ParallelFor themselves: a thread waiting for
+    // its loop runs queued jobs meanwhile, so nesting never adds threads. Once a task throws,
+    // indexes not started yet are skipped, and the first exception is rethrown after every
+    // running call has returned.
+    template <typename Task>
+    void ParallelFor(std::size_t count, Task task);
+
+    // Shared by every user that was not given a pool: a worker per hardware thread besides
+    // the calling one.
+    static ThreadPool& GetDefault();
+
+private:
+    using Job = std::function<void()>;
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+        std::thread thread;
+    };
+    // Shared with the helper jobs of one ParallelFor, which may start after it returned.
+    struct Loop {
+        std::size_t count = 0;
+        std::atomic<std::size_t> next_index{0};
+        std::atomic<std::size_t> done_count{0};
+        std::atomic<bool> has_failed{false};
+        // Set once, by the call that set has_failed.
+        std::exception_ptr exception;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    // Jobs pushed and not taken yet; workers and threads waiting for a loop sleep while it is 0.
+    std::atomic<std::size_t> pending_job_count_{0};
+    std::atomic<std::size_t> next_worker_{0};
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    bool is_stopping_ = false;
+
+    // To the deque of the calling worker, or round robin from other threads.
+    void Push(Job job);
+    // Runs one queued job, own ones first; false if there was none.
+    bool RunPendingJob();
+    void RunWorker(std::size_t index);
+    void Stop();
+
+    void FinishIndex(Loop& loop);
+    void WaitFor(Loop& loop);
+};
+
+template <typename Task>
+void ThreadPool::ParallelFor(std::size_t count, Task task) {
+    if (workers_.empty() || count < 2) {
+        for (std::size_t i = 0; i < count; ++i) {
+            task(i);
+        }
+        return;
+    }
+    const auto loop = std::make_shared<Loop>();
+    loop->count = count;
+    // Indexes are claimed one at a time, so threads that get cheap ones take more. A helper
+    // starting after every index is claimed returns without touching task.
+    const auto run = [this, loop, &task]() {
+        for (std::size_t i = loop->next_index++; i < loop->count; i = loop->next_index++) {
+            if (!loop->has_failed) {
+                try {
+                    task(i);
+                } catch (...) {
+                    if (!loop->has_failed.exchange(true)) {
+                        loop->exception = std::current_exception();
+                    }
+                }
+            }
+            FinishIndex(*loop);
+        }
+    };
+    const std::size_t helper_count = std::min(count - 1, workers_.size());
+    for (std::size_t i = 0; i < helper_count; ++i) {
+        Push(run);
+    }
+    run();
+    WaitFor(*loop);
+    if (loop->exception) {
+        std::rethrow_exception(loop->exception);
+    }
+}
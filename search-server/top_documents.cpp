@@ -0,0 +1,61 @@
+#include "top_documents.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+TopDocuments::TopDocuments(std::size_t max_count)
+    : max_count_(max_count) {
+    heap_.reserve(max_count_);
+}
+
+void TopDocuments::Add(const Document& document) {
+    if (heap_.size() < max_count_) {
+        heap_.push_back(document);
+        std::push_heap(heap_.begin(), heap_.end(), IsBetter);
+    } else if (max_count_ > 0 && IsBetter(document, heap_.front())) {
+        std::pop_heap(heap_.begin(), heap_.end(), IsBetter);
+        heap_.back() = document;
+        std::push_heap(heap_.begin(), heap_.end(), IsBetter);
+    }
+}
+
+void TopDocuments::Merge(const TopDocuments& other) {
+    for (const Document& document : other.heap_) {
+        Add(document);
+    }
+}
+
+bool TopDocuments::IsFull() const {
+    return max_count_ > 0 && heap_.size() == max_count_;
+}
+
+const Document& TopDocuments::GetWorst() const {
+    return heap_.front();
+}
+
+std::vector<Document> TopDocuments::Release() {
+    std::sort_heap(heap_.begin(), heap_.end(), IsBetter);
+    return std::move(heap_);
+}
+
+std::size_t TopDocuments::ReleaseTo(Document* out) {
+    std::sort_heap(heap_.begin(), heap_.end(), IsBetter);
+    std::copy(heap_.begin(), heap_.end(), out);
+    const std::size_t count = heap_.size();
+    heap_.clear();
+    return count;
+}
+
+// Near ties are decided before relevance is compared at all, so two documents within
+// epsilon of each other never both count as better.
+bool TopDocuments::IsBetter(const Document& lhs, const Document& rhs) {
+    const double epsilon = 1e-6;
+    if (std::abs(lhs.relevance - rhs.relevance) < epsilon) {
+        if (lhs.rating != rhs.rating) {
+            return lhs.rating > rhs.rating;
+        }
+        return lhs.id < rhs.id;
+    }
+    return lhs.relevance > rhs.relevance;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include "document.h"
+
+#include <cstddef>
+#include <vector>
+
+// Keeps the best documents seen so far in a bounded heap whose front is the worst kept one.
+class TopDocuments {
+public:
+    explicit TopDocuments(std::size_t max_count);
+
+    void Add(const Document& document);
+
+    void Merge(const TopDocuments& other);
+
+    bool IsFull() const;
+
+    // The document a new one has to beat once the heap is full.
+    const Document& GetWorst() const;
+
+    std::vector<Document> Release();
+    // Moves the kept documents, best first, to out and returns their count. The heap is left
+    // empty for reuse.
+    std::size_t ReleaseTo(Document* out);
+
+    // Higher relevance wins; ties within epsilon go to the higher rating, then the lower id.
+    static bool IsBetter(const Document& lhs, const Document& rhs);
+
+private:
+    std::size_t max_count_;
+    std::vector<Document> heap_;
+};